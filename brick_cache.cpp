@@ -0,0 +1,140 @@
+#include "brick_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "volume_bricks.h"
+#include "voxel_conversion.h"
+
+bool brick_cache::open(const std::string& file_name, const unsigned resolution[3], size_t _voxel_size, size_t _data_offset, bool _swap_bytes, size_t budget_bytes) {
+
+	close();
+
+	if(!file.open(file_name))
+		return false;
+
+	voxel_size = _voxel_size;
+	data_offset = _data_offset;
+	swap_bytes = _swap_bytes && voxel_size > 1;
+
+	for(int i = 0; i < 3; ++i) {
+		volume_res[i] = resolution[i];
+		brick_res[i] = (volume_res[i] + volume_bricks::brick_size - 1) / volume_bricks::brick_size;
+	}
+
+	const size_t num_bytes = static_cast<size_t>(volume_res[0]) * volume_res[1] * volume_res[2] * voxel_size;
+	if(file.size() < data_offset || file.size() - data_offset < num_bytes) {
+		close();
+		return false;
+	}
+
+	// keep at least one brick, otherwise the returned pointer could not stay valid
+	const size_t brick_bytes = static_cast<size_t>(volume_bricks::brick_size) * volume_bricks::brick_size * volume_bricks::brick_size * voxel_size;
+	const size_t capacity = std::max<size_t>(1, std::min(budget_bytes / brick_bytes, get_num_bricks()));
+
+	slots.resize(capacity);
+	for(auto& slot : slots)
+		slot.resize(brick_bytes);
+
+	return true;
+}
+
+void brick_cache::close() {
+
+	file.close();
+	slots.clear();
+	slots.shrink_to_fit();
+	lru.clear();
+	lookup.clear();
+
+	for(int i = 0; i < 3; ++i) {
+		volume_res[i] = 0;
+		brick_res[i] = 0;
+	}
+
+	num_hits = 0;
+	num_misses = 0;
+}
+
+void brick_cache::swap(brick_cache& other) {
+
+	file.swap(other.file);
+	for(int i = 0; i < 3; ++i) {
+		std::swap(volume_res[i], other.volume_res[i]);
+		std::swap(brick_res[i], other.brick_res[i]);
+	}
+	std::swap(voxel_size, other.voxel_size);
+	std::swap(data_offset, other.data_offset);
+	std::swap(swap_bytes, other.swap_bytes);
+	slots.swap(other.slots);
+	lru.swap(other.lru);
+	lookup.swap(other.lookup);
+	std::swap(num_hits, other.num_hits);
+	std::swap(num_misses, other.num_misses);
+}
+
+void brick_cache::get_voxel_range(size_t brick, unsigned begin[3], unsigned end[3]) const {
+
+	const size_t brick_idx[3] = {
+		brick % brick_res[0],
+		(brick / brick_res[0]) % brick_res[1],
+		brick / (static_cast<size_t>(brick_res[0]) * brick_res[1])
+	};
+
+	for(int i = 0; i < 3; ++i) {
+		begin[i] = static_cast<unsigned>(brick_idx[i] * volume_bricks::brick_size);
+		end[i] = std::min(begin[i] + volume_bricks::brick_size, volume_res[i]);
+	}
+}
+
+const uint8_t* brick_cache::get_brick(size_t brick) {
+
+	auto it = lookup.find(brick);
+	if(it != lookup.end()) {
+		++num_hits;
+		lru.splice(lru.begin(), lru, it->second);
+		return slots[it->second->second].data();
+	}
+
+	++num_misses;
+
+	// take a free slot while the cache fills up, afterwards evict the least recently used brick
+	size_t slot;
+	if(lru.size() < slots.size()) {
+		slot = lru.size();
+	} else {
+		slot = lru.back().second;
+		lookup.erase(lru.back().first);
+		lru.pop_back();
+	}
+
+	read_brick(brick, slots[slot].data());
+
+	lru.emplace_front(brick, slot);
+	lookup[brick] = lru.begin();
+	return slots[slot].data();
+}
+
+void brick_cache::read_brick(size_t brick, uint8_t* dst) const {
+
+	unsigned begin[3], end[3];
+	get_voxel_range(brick, begin, end);
+
+	const size_t row_bytes = (end[0] - begin[0]) * voxel_size;
+	const size_t slice_size = static_cast<size_t>(volume_res[0]) * volume_res[1];
+
+	for(unsigned z = begin[2]; z < end[2]; ++z) {
+		for(unsigned y = begin[1]; y < end[1]; ++y) {
+			const uint8_t* src = file.data() + data_offset + (slice_size * z + static_cast<size_t>(volume_res[0]) * y + begin[0]) * voxel_size;
+
+			if(!swap_bytes)
+				std::memcpy(dst, src, row_bytes);
+			else if(voxel_size == 2)
+				swap_bytes_16(src, dst, row_bytes / 2);
+			else
+				swap_bytes_32(src, dst, row_bytes / 4);
+
+			dst += row_bytes;
+		}
+	}
+}
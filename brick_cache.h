@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "mapped_file.h"
+
+/// read-only access to a raw voxel file that is too large for host memory, by bricks of volume_bricks::brick_size voxels per axis
+/// which are decoded lazily into a bounded least-recently-used cache
+class brick_cache
+{
+public:
+	/// open the voxel file with the given resolution and voxel layout; the cache keeps at most budget_bytes of decoded bricks
+	bool open(const std::string& file_name, const unsigned resolution[3], size_t voxel_size, size_t data_offset, bool swap_bytes, size_t budget_bytes);
+	void close();
+	/// exchange the files and cached bricks of both caches, so a file can be opened before it replaces the current one
+	void swap(brick_cache& other);
+
+	bool is_open() const { return file.is_open(); }
+	size_t get_voxel_size() const { return voxel_size; }
+	const unsigned* get_brick_resolution() const { return brick_res; }
+	size_t get_num_bricks() const { return static_cast<size_t>(brick_res[0]) * brick_res[1] * brick_res[2]; }
+
+	/// first voxel index (inclusive) and last voxel index (exclusive) of the brick along each axis
+	void get_voxel_range(size_t brick, unsigned begin[3], unsigned end[3]) const;
+
+	/// return the voxels of the brick densely packed in x-fastest order and host byte order; the pointer stays valid until the next call
+	const uint8_t* get_brick(size_t brick);
+
+	size_t get_num_hits() const { return num_hits; }
+	size_t get_num_misses() const { return num_misses; }
+	size_t get_capacity() const { return slots.size(); }
+
+private:
+	void read_brick(size_t brick, uint8_t* dst) const;
+
+	mapped_file file;
+	unsigned volume_res[3] = { 0, 0, 0 };
+	unsigned brick_res[3] = { 0, 0, 0 };
+	size_t voxel_size = 1;
+	size_t data_offset = 0;
+	bool swap_bytes = false;
+
+	/// decoded bricks, each slot large enough for a full brick
+	std::vector<std::vector<uint8_t>> slots;
+	/// brick indices ordered from most to least recently used, together with the slot they occupy
+	std::list<std::pair<size_t, size_t>> lru;
+	std::unordered_map<size_t, std::list<std::pair<size_t, size_t>>::iterator> lookup;
+
+	size_t num_hits = 0;
+	size_t num_misses = 0;
+};
@@ -16,6 +16,7 @@
 #include "fpng.h"
 #include <assert.h>
 #include <string.h>
+#include <thread>
 
 #ifdef _MSC_VER
 	#pragma warning (disable:4127) // conditional expression is constant
@@ -43,10 +44,37 @@
 	#include <wmmintrin.h>		// pclmul
 #endif
 
+// Set FPNG_NO_AVX2 to 1 to leave out the AVX2 and VPCLMULQDQ code paths, e.g. for compilers without their intrinsics.
+#ifndef FPNG_NO_AVX2
+	#define FPNG_NO_AVX2 (0)
+#endif
+
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE && !FPNG_NO_AVX2
+	#define FPNG_AVX2 (1)
+	#include <immintrin.h>		// AVX2, VPCLMULQDQ
+	// The AVX2 functions are compiled for AVX2 regardless of the compiler flags and only called if fpng_init() found the CPU supports it
+	#if defined(__GNUC__) || defined(__clang__)
+		#define FPNG_TARGET_AVX2 __attribute__((target("avx2")))
+		#define FPNG_TARGET_AVX2_VPCLMUL __attribute__((target("avx2,pclmul,vpclmulqdq")))
+	#else
+		#define FPNG_TARGET_AVX2
+		#define FPNG_TARGET_AVX2_VPCLMUL
+	#endif
+#else
+	#define FPNG_AVX2 (0)
+#endif
+
 #ifndef FPNG_NO_STDIO
 	#include <stdio.h>
 #endif
 
+// write() for streaming to file descriptors
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
 // Allow the disabling of the chunk data CRC32 checks, for fuzz testing of the decoder
 #ifndef FPNG_DISABLE_DECODE_CRC32_CHECKS
 	#define FPNG_DISABLE_DECODE_CRC32_CHECKS (0)
@@ -252,10 +280,21 @@ namespace fpng
 	// See Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction":
 	// https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/fast-crc-computation-generic-polynomials-pclmulqdq-paper.pdf
 	// Requires PCLMUL and SSE 4.1. This function skips Step 1 (fold by 4) for simplicity/less code.
+	static uint32_t crc32_pclmul_finish(__m128i b, const uint8_t* p, size_t size);
+
 	static uint32_t crc32_pclmul(const uint8_t* p, size_t size, uint32_t crc)
 	{
 		assert(size >= 16);
 
+		// Load first 16 bytes, apply initial CRC32
+		__m128i b = _mm_xor_si128(_mm_cvtsi32_si128(~crc), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+
+		return crc32_pclmul_finish(b, p + 16, size - 16);
+	}
+
+	// Folds the remaining multiple of 16 bytes into the 128-bit remainder b and reduces it to the final CRC-32
+	static uint32_t crc32_pclmul_finish(__m128i b, const uint8_t* p, size_t size)
+	{
 		// See page 22 (bit reflected constants for gzip)
 #ifdef _MSC_VER
 		static const uint64_t __declspec(align(16)) 
@@ -264,13 +303,10 @@ namespace fpng
 #endif
 			s_u[2] = { 0x1DB710641, 0x1F7011641 }, s_k5k0[2] = { 0x163CD6124, 0 }, s_k3k4[2] = { 0x1751997D0, 0xCCAA009E };
 
-		// Load first 16 bytes, apply initial CRC32
-		__m128i b = _mm_xor_si128(_mm_cvtsi32_si128(~crc), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
-
 		// We're skipping directly to Step 2 page 12 - iteratively folding by 1 (by 4 is overkill for our needs)
 		const __m128i k3k4 = _mm_load_si128(reinterpret_cast<const __m128i*>(s_k3k4));
 
-		for (size -= 16, p += 16; size >= 16; size -= 16, p += 16)
+		for ( ; size >= 16; size -= 16, p += 16)
 			b = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(b, k3k4, 17), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p))), _mm_clmulepi64_si128(b, k3k4, 0));
 
 		// Final stages: fold to 64-bits, 32-bit Barrett reduction
@@ -280,13 +316,63 @@ namespace fpng
 		return ~_mm_extract_epi32(_mm_xor_si128(b, _mm_clmulepi64_si128(_mm_and_si128(_mm_clmulepi64_si128(_mm_and_si128(b, z), u, 16), z), u, 0)), 1);
 	}
 
-	static uint32_t crc32_sse41_simd(const unsigned char* buf, size_t len, uint32_t prev_crc32)
+#if FPNG_AVX2
+	FPNG_TARGET_AVX2_VPCLMUL static inline __m256i crc32_fold_256(__m256i x, __m256i k, __m256i data)
+	{
+		return _mm256_xor_si256(_mm256_xor_si256(_mm256_clmulepi64_epi128(x, k, 0x00), _mm256_clmulepi64_epi128(x, k, 0x11)), data);
+	}
+
+	// Same folding as crc32_pclmul(), but on two 128-bit lanes per register and four registers at once, so each iteration folds 128 bytes.
+	// Requires AVX2 and VPCLMULQDQ. The constants for a fold distance of D bits are (x^(D+32) mod P)' << 1 and (x^(D-32) mod P)' << 1.
+	FPNG_TARGET_AVX2_VPCLMUL static uint32_t crc32_vpclmul(const uint8_t* p, size_t size, uint32_t crc)
+	{
+		assert((size >= 128) && ((size & 15) == 0));
+
+		const __m256i k1024 = _mm256_setr_epi64x(0x1E88EF372, 0x14A7FE880, 0x1E88EF372, 0x14A7FE880);
+		const __m256i k256 = _mm256_setr_epi64x(0xF1DA05AA, 0x15A546366, 0xF1DA05AA, 0x15A546366);
+
+		// Load first 128 bytes, apply initial CRC32
+		__m256i x0 = _mm256_xor_si256(_mm256_setr_epi32((int)~crc, 0, 0, 0, 0, 0, 0, 0), _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+		__m256i x1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+		__m256i x2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 64));
+		__m256i x3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 96));
+
+		for (size -= 128, p += 128; size >= 128; size -= 128, p += 128)
+		{
+			x0 = crc32_fold_256(x0, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+			x1 = crc32_fold_256(x1, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32)));
+			x2 = crc32_fold_256(x2, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 64)));
+			x3 = crc32_fold_256(x3, k1024, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 96)));
+		}
+
+		// Fold the four registers into one, then the remaining 32 byte blocks
+		x3 = crc32_fold_256(crc32_fold_256(crc32_fold_256(x0, k256, x1), k256, x2), k256, x3);
+		for ( ; size >= 32; size -= 32, p += 32)
+			x3 = crc32_fold_256(x3, k256, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+
+		// Fold the lower lane into the upper one and continue with 128-bit folding
+		const __m128i k3k4 = _mm_set_epi64x(0xCCAA009E, 0x1751997D0);
+		const __m128i lo = _mm256_castsi256_si128(x3);
+		const __m128i b = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(lo, k3k4, 0x00), _mm_clmulepi64_si128(lo, k3k4, 0x11)), _mm256_extracti128_si256(x3, 1));
+
+		return crc32_pclmul_finish(b, p, size);
+	}
+#endif
+
+	static uint32_t crc32_sse41_simd(const unsigned char* buf, size_t len, uint32_t prev_crc32, bool use_vpclmul)
 	{
+		(void)use_vpclmul;
 		if (len < 16)
 			return crc32_slice_by_4(buf, len, prev_crc32);
 
 		uint32_t simd_len = len & ~15;
-		uint32_t c = crc32_pclmul(buf, simd_len, prev_crc32);
+		uint32_t c;
+#if FPNG_AVX2
+		if ((simd_len >= 256) && use_vpclmul)
+			c = crc32_vpclmul(buf, simd_len, prev_crc32);
+		else
+#endif
+			c = crc32_pclmul(buf, simd_len, prev_crc32);
 		return crc32_slice_by_4(buf + simd_len, len - simd_len, c);
 	}
 #endif
@@ -316,6 +402,10 @@ namespace fpng
 		cpu_info() { memset(this, 0, sizeof(*this)); }
 
 		bool m_initialized, m_has_fpu, m_has_mmx, m_has_sse, m_has_sse2, m_has_sse3, m_has_ssse3, m_has_sse41, m_has_sse42, m_has_avx, m_has_avx2, m_has_pclmulqdq;
+		bool m_has_osxsave, m_os_saves_ymm, m_has_vpclmulqdq;
+
+		// Highest code path the kernels may take, see fpng_set_simd_level()
+		uint32_t m_simd_limit;
 				
 		void init()
 		{
@@ -341,6 +431,10 @@ namespace fpng
 				extract_x86_flags(regs[2], regs[3]);
 			}
 
+			// The OS must save the upper halves of the YMM registers on context switches, otherwise AVX instructions can't be used
+			if (m_has_osxsave)
+				m_os_saves_ymm = (read_xcr0() & 6) == 6;
+
 			if (max_eax >= 7U)
 			{
 #ifdef _MSC_VER
@@ -348,24 +442,38 @@ namespace fpng
 #else
 				do_cpuid(7, 0, (uint32_t*)regs);
 #endif
-				extract_x86_extended_flags(regs[1]);
+				extract_x86_extended_flags(regs[1], regs[2]);
 			}
 
+			m_simd_limit = FPNG_SIMD_AVX2;
 			m_initialized = true;
 		}
 
-		bool can_use_sse41() const { return m_has_sse && m_has_sse2 && m_has_sse3 && m_has_ssse3 && m_has_sse41; }
+		bool can_use_sse41() const { return m_has_sse && m_has_sse2 && m_has_sse3 && m_has_ssse3 && m_has_sse41 && (m_simd_limit >= FPNG_SIMD_SSE41); }
 		bool can_use_pclmul() const	{ return m_has_pclmulqdq && can_use_sse41(); }
+		bool can_use_avx2() const { return FPNG_AVX2 && m_has_avx && m_has_avx2 && m_os_saves_ymm && can_use_sse41() && (m_simd_limit >= FPNG_SIMD_AVX2); }
+		bool can_use_vpclmul() const { return m_has_vpclmulqdq && can_use_pclmul() && can_use_avx2(); }
 
 	private:
 		void extract_x86_flags(uint32_t ecx, uint32_t edx)
 		{
 			m_has_fpu = (edx & (1 << 0)) != 0;	m_has_mmx = (edx & (1 << 23)) != 0;	m_has_sse = (edx & (1 << 25)) != 0; m_has_sse2 = (edx & (1 << 26)) != 0;
 			m_has_sse3 = (ecx & (1 << 0)) != 0; m_has_ssse3 = (ecx & (1 << 9)) != 0; m_has_sse41 = (ecx & (1 << 19)) != 0; m_has_sse42 = (ecx & (1 << 20)) != 0;
-			m_has_pclmulqdq = (ecx & (1 << 1)) != 0; m_has_avx = (ecx & (1 << 28)) != 0;
+			m_has_pclmulqdq = (ecx & (1 << 1)) != 0; m_has_avx = (ecx & (1 << 28)) != 0; m_has_osxsave = (ecx & (1 << 27)) != 0;
 		}
 
-		void extract_x86_extended_flags(uint32_t ebx) { m_has_avx2 = (ebx & (1 << 5)) != 0; }
+		void extract_x86_extended_flags(uint32_t ebx, uint32_t ecx) { m_has_avx2 = (ebx & (1 << 5)) != 0; m_has_vpclmulqdq = (ecx & (1 << 10)) != 0; }
+
+		static uint64_t read_xcr0()
+		{
+#ifdef _MSC_VER
+			return _xgetbv(0);
+#else
+			uint32_t eax, edx;
+			__asm__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+			return ((uint64_t)edx << 32) | eax;
+#endif
+		}
 	};
 
 	cpu_info g_cpu_info;
@@ -380,6 +488,29 @@ namespace fpng
 	}
 #endif
 
+	uint32_t fpng_get_simd_level()
+	{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
+		assert(g_cpu_info.m_initialized);
+		if (g_cpu_info.can_use_avx2())
+			return FPNG_SIMD_AVX2;
+		if (g_cpu_info.can_use_sse41())
+			return FPNG_SIMD_SSE41;
+#endif
+		return FPNG_SIMD_SCALAR;
+	}
+
+	uint32_t fpng_set_simd_level(uint32_t level)
+	{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
+		assert(g_cpu_info.m_initialized);
+		g_cpu_info.m_simd_limit = minimum<uint32_t>(level, FPNG_SIMD_AVX2);
+#else
+		(void)level;
+#endif
+		return fpng_get_simd_level();
+	}
+
 	bool fpng_cpu_supports_sse41()
 	{
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
@@ -394,7 +525,7 @@ namespace fpng
 	{
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
 		if (g_cpu_info.can_use_pclmul())
-			return crc32_sse41_simd(static_cast<const uint8_t *>(pData), size, prev_crc32);
+			return crc32_sse41_simd(static_cast<const uint8_t *>(pData), size, prev_crc32, g_cpu_info.can_use_vpclmul());
 #endif
 
 		return crc32_slice_by_4(pData, size, prev_crc32);
@@ -460,6 +591,56 @@ namespace fpng
 
 		return (s1 % K) | ((s2 % K) << 16);
 	}
+
+#if FPNG_AVX2
+	FPNG_TARGET_AVX2 static inline uint64_t hsum_epi32_avx2(__m256i v)
+	{
+		uint32_t a[8];
+		_mm256_storeu_si256((__m256i*)a, v);
+		return (uint64_t)a[0] + a[1] + a[2] + a[3] + a[4] + a[5] + a[6] + a[7];
+	}
+
+	// AVX2, 32 bytes per iteration. s1 is summed with SAD against zero, the per-byte weights of s2 with a multiply-add against 32..1, 
+	// and the s1 carried into each block is accumulated separately and weighted by 32 at the end.
+	FPNG_TARGET_AVX2 static uint32_t adler32_avx2(const uint8_t* p, size_t len, uint32_t initial)
+	{
+		uint32_t s1 = initial & 0xFFFF, s2 = initial >> 16;
+		const uint32_t K = 65521;
+
+		const __m256i taps = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+		const __m256i ones = _mm256_set1_epi16(1), zero = _mm256_setzero_si256();
+
+		while (len >= 32)
+		{
+			// 173*32 bytes stay below the 5552 byte limit, so no lane can overflow
+			const size_t n = minimum<size_t>(len >> 5, 173);
+
+			__m256i v_s1 = zero, v_s2 = zero, v_ps = zero;
+			for (size_t i = 0; i < n; i++)
+			{
+				const __m256i v = _mm256_loadu_si256((const __m256i*)(p + i * 32));
+				v_ps = _mm256_add_epi32(v_ps, v_s1);
+				v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(v, zero));
+				v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(v, taps), ones));
+			}
+
+			const uint64_t vs2 = s2 + (uint64_t)s1 * (n * 32) + hsum_epi32_avx2(v_ps) * 32 + hsum_epi32_avx2(v_s2);
+			s1 = (uint32_t)((s1 + hsum_epi32_avx2(v_s1)) % K);
+			s2 = (uint32_t)(vs2 % K);
+
+			p += n * 32;
+			len -= n * 32;
+		}
+
+		for (; len; len--)
+		{
+			s1 += *p++;
+			s2 += s1;
+		}
+
+		return (s1 % K) | ((s2 % K) << 16);
+	}
+#endif
 #endif
 
 	static uint32_t fpng_adler32_scalar(const uint8_t* ptr, size_t buf_len, uint32_t adler)
@@ -479,6 +660,10 @@ namespace fpng
 
 	uint32_t fpng_adler32(const void* pData, size_t size, uint32_t adler)
 	{
+#if FPNG_AVX2
+		if (g_cpu_info.can_use_avx2())
+			return adler32_avx2((const uint8_t*)pData, size, adler);
+#endif
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE 
 		if (g_cpu_info.can_use_sse41())
 			return adler32_sse_16((const uint8_t*)pData, size, adler);
@@ -486,6 +671,239 @@ namespace fpng
 		return fpng_adler32_scalar((const uint8_t*)pData, size, adler);
 	}
 
+	// Same math as zlib's crc32_combine() and adler32_combine().
+
+	// Multiplies a and b modulo the reflected CRC-32 polynomial
+	static uint32_t crc32_mult_mod_p(uint32_t a, uint32_t b)
+	{
+		uint32_t m = 1U << 31, p = 0;
+		for ( ; ; )
+		{
+			if (a & m)
+			{
+				p ^= b;
+				if ((a & (m - 1)) == 0)
+					break;
+			}
+			m >>= 1;
+			b = (b & 1) ? ((b >> 1) ^ 0xEDB88320) : (b >> 1);
+		}
+		return p;
+	}
+
+	// x^(8*len) modulo the CRC-32 polynomial, the operator that shifts a CRC over len zero bytes
+	static uint32_t crc32_shift_op(uint64_t len)
+	{
+		// x^(2^k) for k = 3..66, squared from x^1
+		struct x2n_table
+		{
+			uint32_t m_pow[64];
+			x2n_table()
+			{
+				uint32_t p = 1U << 30;
+				for (uint32_t k = 0; k < 3; k++)
+					p = crc32_mult_mod_p(p, p);
+				for (uint32_t k = 0; k < 64; k++, p = crc32_mult_mod_p(p, p))
+					m_pow[k] = p;
+			}
+		};
+		static const x2n_table s_table;
+
+		uint32_t p = 1U << 31;
+		for (uint32_t k = 0; len; len >>= 1, k++)
+			if (len & 1)
+				p = crc32_mult_mod_p(s_table.m_pow[k], p);
+		return p;
+	}
+
+	uint32_t fpng_crc32_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b)
+	{
+		return crc32_mult_mod_p(crc32_shift_op(len_b), crc_a) ^ crc_b;
+	}
+
+	// Adler-32 of the data summed into adler followed by len zero bytes, each of which leaves s1 as it is and adds it to s2
+	static inline uint32_t adler32_append_zeros(uint32_t adler, uint64_t len)
+	{
+		const uint32_t K = 65521;
+		const uint32_t s1 = adler & 0xFFFF;
+		return s1 | ((uint32_t)(((adler >> 16) + (len % K) * s1) % K) << 16);
+	}
+
+	uint32_t fpng_adler32_combine(uint32_t adler_a, uint32_t adler_b, uint64_t len_b)
+	{
+		const uint32_t K = 65521;
+		const uint32_t rem = (uint32_t)(len_b % K);
+		uint32_t s1 = adler_a & 0xFFFF;
+		uint32_t s2 = (uint32_t)(((uint64_t)rem * s1) % K);
+		s1 += (adler_b & 0xFFFF) + K - 1;
+		s2 += (adler_a >> 16) + (adler_b >> 16) + K - rem;
+		if (s1 >= K) s1 -= K;
+		if (s1 >= K) s1 -= K;
+		if (s2 >= (K << 1)) s2 -= (K << 1);
+		if (s2 >= K) s2 -= K;
+		return s1 | (s2 << 16);
+	}
+
+	static uint32_t get_num_threads(uint32_t num_threads)
+	{
+		return num_threads ? num_threads : maximum<uint32_t>(1, std::thread::hardware_concurrency());
+	}
+
+	// Calls f(i) for i in [0, n), each on its own thread, with the calling thread taking i = 0
+	template <typename F>
+	static void run_parallel(uint32_t n, F&& f)
+	{
+		std::vector<std::thread> threads;
+		threads.reserve(n ? n - 1 : 0);
+		for (uint32_t i = 1; i < n; i++)
+			threads.emplace_back(f, i);
+		if (n)
+			f(0);
+		for (auto& t : threads)
+			t.join();
+	}
+
+	// Splits the buffer into one part per thread, hashes the parts concurrently and combines the results
+	template <typename HASH, typename COMBINE>
+	static uint32_t checksum_parallel(const uint8_t* pData, size_t size, uint32_t prev, uint32_t init, uint32_t num_threads, HASH&& hash, COMBINE&& combine)
+	{
+		// Smaller parts don't make up for starting a thread
+		const size_t MIN_PART_SIZE = 1024 * 1024;
+
+		const uint32_t num_parts = (uint32_t)minimum<uint64_t>(get_num_threads(num_threads), maximum<uint64_t>(1, size / MIN_PART_SIZE));
+		if (num_parts <= 1)
+			return hash(pData, size, prev);
+
+		std::vector<uint32_t> part_sums(num_parts);
+		run_parallel(num_parts, [&](uint32_t i)
+		{
+			const size_t begin = (size * i) / num_parts, end = (size * (i + 1)) / num_parts;
+			part_sums[i] = hash(pData + begin, end - begin, i ? init : prev);
+		});
+
+		uint32_t sum = part_sums[0];
+		for (uint32_t i = 1; i < num_parts; i++)
+			sum = combine(sum, part_sums[i], (size * (i + 1)) / num_parts - (size * i) / num_parts);
+		return sum;
+	}
+
+	uint32_t fpng_crc32_parallel(const void* pData, size_t size, uint32_t prev_crc32, uint32_t num_threads)
+	{
+		return checksum_parallel(static_cast<const uint8_t*>(pData), size, prev_crc32, FPNG_CRC32_INIT, num_threads, fpng_crc32, fpng_crc32_combine);
+	}
+
+	uint32_t fpng_adler32_parallel(const void* pData, size_t size, uint32_t adler, uint32_t num_threads)
+	{
+		return checksum_parallel(static_cast<const uint8_t*>(pData), size, adler, FPNG_ADLER32_INIT, num_threads, fpng_adler32, fpng_adler32_combine);
+	}
+
+#if FPNG_SELF_TEST
+	uint32_t fpng_self_test()
+	{
+		const uint32_t prev_simd_level = fpng_get_simd_level();
+		uint32_t num_failures = 0;
+
+		// Deterministic pseudo random data (xorshift), so a failure can be reproduced, large enough to be split into several parallel parts
+		const size_t TEST_SIZE = 5 * 1024 * 1024 + 123;
+		std::vector<uint8_t> buf(TEST_SIZE);
+		uint32_t seed = 0x9E3779B9;
+		auto next_rand = [&]() { seed ^= seed << 13; seed ^= seed >> 17; seed ^= seed << 5; return seed; };
+		for (size_t i = 0; i < TEST_SIZE; i++)
+			buf[i] = (uint8_t)next_rand();
+
+		// A run of 0xFF bytes drives the Adler-32 sums to their maximum between the modulo reductions
+		memset(buf.data() + 4096, 0xFF, 256 * 1024);
+
+		for (uint32_t level = FPNG_SIMD_SCALAR; level <= FPNG_SIMD_AVX2; level++)
+		{
+			// Levels the CPU doesn't support fall back to a lower one, which has been tested already
+			if (fpng_set_simd_level(level) != level)
+				continue;
+
+			// Every length up to 1 KB covers the tails of the SIMD loops, random lengths up to 256 KB the block loops and the Adler-32 reductions
+			for (uint32_t i = 0; i < 1024 + 256; i++)
+			{
+				const uint8_t* p = buf.data() + next_rand() % 64;
+				const size_t len = (i < 1024) ? i : next_rand() % (256 * 1024);
+				const uint32_t crc_init = next_rand();
+				const uint32_t adler_init = (next_rand() % 65521) | ((next_rand() % 65521) << 16);
+
+				const uint32_t crc = crc32_slice_by_4(p, len, crc_init);
+				const uint32_t adler = fpng_adler32_scalar(p, len, adler_init);
+
+				if (fpng_crc32(p, len, crc_init) != crc)
+					num_failures++;
+				if (fpng_adler32(p, len, adler_init) != adler)
+					num_failures++;
+
+				const size_t split = next_rand() % (len + 1);
+				if (fpng_crc32_combine(fpng_crc32(p, split, crc_init), fpng_crc32(p + split, len - split, FPNG_CRC32_INIT), len - split) != crc)
+					num_failures++;
+				if (fpng_adler32_combine(fpng_adler32(p, split, adler_init), fpng_adler32(p + split, len - split, FPNG_ADLER32_INIT), len - split) != adler)
+					num_failures++;
+			}
+
+			// Sizes below, between and above the parallel part size, hashed with thread counts that do and don't divide them
+			const size_t parallel_sizes[] = { 1024 * 1024 - 1, 3 * 1024 * 1024 + 1, TEST_SIZE };
+			const uint32_t thread_counts[] = { 0, 1, 2, 3, 4, 7, 16 };
+			for (size_t size : parallel_sizes)
+			{
+				const uint32_t crc_init = next_rand();
+				const uint32_t adler_init = (next_rand() % 65521) | ((next_rand() % 65521) << 16);
+
+				const uint32_t crc = crc32_slice_by_4(buf.data(), size, crc_init);
+				const uint32_t adler = fpng_adler32_scalar(buf.data(), size, adler_init);
+
+				for (uint32_t num_threads : thread_counts)
+				{
+					if (fpng_crc32_parallel(buf.data(), size, crc_init, num_threads) != crc)
+						num_failures++;
+					if (fpng_adler32_parallel(buf.data(), size, adler_init, num_threads) != adler)
+						num_failures++;
+				}
+			}
+
+			// Images whose upper half is noise, so the stream encoder stores those bands with their filters, followed by compressed bands.
+			// They are streamed by rows and by tiles and must decode to the same pixels.
+			const uint32_t w = 700, h = 800;
+			for (uint32_t num_chans = 3; num_chans <= 4; num_chans++)
+			{
+				std::vector<uint8_t> pixels((size_t)w * h * num_chans);
+				for (size_t i = 0; i < pixels.size(); i++)
+					pixels[i] = (i < pixels.size() / 2) ? (uint8_t)next_rand() : (uint8_t)(i / ((size_t)w * num_chans));
+
+				for (uint32_t flags = 0; flags <= FPNG_ENCODE_ADAPTIVE_FILTERS; flags += FPNG_ENCODE_ADAPTIVE_FILTERS)
+				{
+					for (uint32_t tiled = 0; tiled < 2; tiled++)
+					{
+						std::vector<uint8_t> png;
+						fpng_stream_encoder stream;
+						bool success = stream.begin(w, h, num_chans, [](const void* pData, size_t size, void* pUser)
+						{
+							std::vector<uint8_t>& out = *static_cast<std::vector<uint8_t>*>(pUser);
+							out.insert(out.end(), static_cast<const uint8_t*>(pData), static_cast<const uint8_t*>(pData) + size);
+							return true;
+						}, &png, flags);
+
+						const uint32_t tile_w = tiled ? 128 : w, tile_h = 16;
+						for (uint32_t y = 0; (y < h) && success; y += tile_h)
+							for (uint32_t x = 0; (x < w) && success; x += tile_w)
+								success = stream.add_tile(x, &pixels[((size_t)y * w + x) * num_chans], minimum(tile_w, w - x), minimum(tile_h, h - y), (int64_t)w * num_chans);
+
+						std::vector<uint8_t> decoded;
+						uint32_t decoded_w, decoded_h, channels_in_file;
+						if ((!success) || (!stream.end()) || (fpng_decode_memory(png.data(), (uint32_t)png.size(), decoded, decoded_w, decoded_h, channels_in_file, num_chans) != FPNG_DECODE_SUCCESS) || (decoded != pixels))
+							num_failures++;
+					}
+				}
+			}
+		}
+
+		fpng_set_simd_level(prev_simd_level);
+		return num_failures;
+	}
+#endif
+
 	// Ensure we've been configured for endianness correctly.
 	static inline bool endian_check()
 	{
@@ -527,13 +945,15 @@ namespace fpng
 		
 	static const uint32_t g_bitmasks[17] = { 0x0000, 0x0001, 0x0003, 0x0007, 0x000F, 0x001F, 0x003F, 0x007F, 0x00FF, 0x01FF, 0x03FF, 0x07FF, 0x0FFF, 0x1FFF, 0x3FFF, 0x7FFF, 0xFFFF };
 
+	struct dyn_huff_code { uint8_t m_code_size; uint16_t m_code; };
+
 	// Huffman tables generated by fpng_test -t @filelist.txt. Total alpha files : 1440, Total opaque files : 5627.
 	// Feel free to retrain the encoder on your opaque/alpha PNG files by setting FPNG_TRAIN_HUFFMAN_TABLES and running fpng_test with the -t option.
 	static const uint8_t g_dyn_huff_3[] = {
 	120, 1, 237, 195, 3, 176, 110, 89, 122, 128, 225, 247, 251, 214, 218, 248, 113, 124, 173, 190, 109, 12, 50, 201, 196, 182, 109, 219, 182, 109, 219, 182,
 	109, 219, 201, 36, 147, 153, 105, 235, 246, 53, 142, 207, 143, 141, 181, 214, 151, 93, 117, 170, 78, 117, 117, 58, 206, 77, 210, 217, 169, 122 };
 	const uint32_t DYN_HUFF_3_BITBUF = 30, DYN_HUFF_3_BITBUF_SIZE = 7;
-	static const struct { uint8_t m_code_size; uint16_t m_code; } g_dyn_huff_3_codes[288] = {
+	static const dyn_huff_code g_dyn_huff_3_codes[288] = {
 	{2,0},{4,2},{4,10},{5,14},{5,30},{6,25},{6,57},{6,5},{6,37},{7,3},{7,67},{7,35},{7,99},{8,11},{8,139},{8,75},{8,203},{8,43},{8,171},{8,107},{9,135},{9,391},{9,71},{9,327},{9,199},{9,455},{9,39},{9,295},{9,167},{9,423},{9,103},{10,183},
 	{9,359},{10,695},{10,439},{10,951},{10,119},{10,631},{10,375},{10,887},{10,247},{10,759},{10,503},{11,975},{11,1999},{11,47},{11,1071},{12,1199},{11,559},{12,3247},{12,687},{11,1583},{12,2735},{12,1711},{12,3759},{12,431},{12,2479},{12,1455},{12,3503},{12,943},{12,2991},{12,1967},{12,4015},{12,111},
 	{12,2159},{12,1135},{12,3183},{12,623},{12,2671},{12,1647},{12,3695},{12,367},{12,2415},{12,1391},{12,3439},{12,879},{12,2927},{12,1903},{12,3951},{12,239},{12,2287},{12,1263},{12,3311},{12,751},{12,2799},{12,1775},{12,3823},{12,495},{12,2543},{12,1519},{12,3567},{12,1007},{12,3055},{12,2031},{12,4079},{12,31},
@@ -549,7 +969,7 @@ namespace fpng
 	120, 1, 229, 196, 99, 180, 37, 103, 218, 128, 225, 251, 121, 171, 106, 243, 216, 231, 180, 109, 196, 182, 51, 51, 73, 6, 201, 216, 182, 109, 219, 182,
 	17, 140, 98, 219, 102, 219, 60, 125, 172, 205, 170, 122, 159, 111, 213, 143, 179, 214, 94, 189, 58, 153, 104, 166, 103, 190, 247, 199, 117 };
 	const uint32_t DYN_HUFF_4_BITBUF = 1, DYN_HUFF_4_BITBUF_SIZE = 2;
-	static const struct { uint8_t m_code_size; uint16_t m_code; } g_dyn_huff_4_codes[288] = {
+	static const dyn_huff_code g_dyn_huff_4_codes[288] = {
 	{2,0},{4,2},{5,6},{6,30},{6,62},{6,1},{7,41},{7,105},{7,25},{7,89},{7,57},{7,121},{8,117},{8,245},{8,13},{8,141},{8,77},{8,205},{8,45},{8,173},{8,109},{8,237},{8,29},{8,157},{8,93},{8,221},{8,61},{9,83},{9,339},{9,211},{9,467},{9,51},
 	{9,307},{9,179},{9,435},{9,115},{9,371},{9,243},{9,499},{9,11},{9,267},{9,139},{9,395},{9,75},{9,331},{9,203},{9,459},{9,43},{9,299},{10,7},{10,519},{10,263},{10,775},{10,135},{10,647},{10,391},{10,903},{10,71},{10,583},{10,327},{10,839},{10,199},{10,711},{10,455},
 	{10,967},{10,39},{10,551},{10,295},{10,807},{10,167},{10,679},{10,423},{10,935},{10,103},{10,615},{11,463},{11,1487},{11,975},{10,359},{10,871},{10,231},{11,1999},{11,47},{11,1071},{11,559},{10,743},{10,487},{11,1583},{11,303},{11,1327},{11,815},{11,1839},{11,175},{11,1199},{11,687},{11,1711},
@@ -561,6 +981,41 @@ namespace fpng
 	{12,2047},{0,0},{6,9},{0,0},{0,0},{0,0},{8,147},{0,0},{0,0},{7,53},{0,0},{9,379},{0,0},{9,251},{10,911},{10,79},{11,767},{10,591},{10,335},{10,847},{10,207},{10,719},{11,1791},{11,511},{9,507},{11,1535},{11,1023},{12,4095},{5,14},{0,0},{0,0},{0,0}
 	};
 
+	// Alpha Huffman tables for FPNG_ENCODE_VOLUME_TABLES, trained on 48 renders of slice_renderer's generated volume on transparent black, 512 and 768 pixels
+	// square, under the first three transfer function presets and encoded with Up and adaptive filters. Retrain them with slice_renderer's Train PNG Tables.
+	static const uint8_t g_dyn_huff_4_volume[] = {
+	120, 1, 229, 196, 83, 176, 36, 91, 152, 134, 225, 247, 251, 87, 162, 170, 182, 186, 251, 140, 109, 219, 182, 109, 219, 182, 109, 219, 182, 109, 219, 182,
+	109, 158, 198, 86, 33, 51, 215, 255, 77, 228, 69, 69, 236, 232, 24, 123, 166, 46, 158 };
+	const uint32_t DYN_HUFF_4_VOLUME_BITBUF = 7, DYN_HUFF_4_VOLUME_BITBUF_SIZE = 5;
+	static const dyn_huff_code g_dyn_huff_4_volume_codes[288] = {
+	{2,0},{3,2},{4,1},{5,5},{6,13},{6,45},{6,29},{6,61},{7,11},{7,75},{7,43},{8,71},{8,199},{8,39},{8,167},{8,103},{9,183},{9,439},{9,119},{10,143},{12,399},{12,2447},{12,1423},{12,3471},{12,911},{12,2959},{12,1935},{12,3983},{12,79},{12,2127},{12,1103},{12,3151},
+	{12,591},{12,2639},{12,1615},{12,3663},{12,335},{12,2383},{12,1359},{12,3407},{12,847},{12,2895},{12,1871},{12,3919},{12,207},{12,2255},{12,1231},{12,3279},{12,719},{12,2767},{12,1743},{12,3791},{12,463},{12,2511},{12,1487},{12,3535},{12,975},{12,3023},{12,1999},{12,4047},{12,47},{12,2095},{12,1071},{12,3119},
+	{12,559},{12,2607},{12,1583},{12,3631},{12,303},{12,2351},{12,1327},{12,3375},{12,815},{12,2863},{12,1839},{12,3887},{12,175},{12,2223},{12,1199},{12,3247},{12,687},{12,2735},{12,1711},{12,3759},{12,431},{12,2479},{12,1455},{12,3503},{12,943},{12,2991},{12,1967},{12,4015},{12,111},{12,2159},{12,1135},{12,3183},
+	{12,623},{12,2671},{12,1647},{12,3695},{12,367},{12,2415},{12,1391},{12,3439},{12,879},{12,2927},{12,1903},{12,3951},{12,239},{12,2287},{12,1263},{12,3311},{12,751},{12,2799},{12,1775},{12,3823},{12,495},{12,2543},{12,1519},{12,3567},{12,1007},{12,3055},{12,2031},{12,4079},{12,31},{12,2079},{12,1055},{12,3103},
+	{12,543},{12,2591},{12,1567},{12,3615},{12,287},{12,2335},{12,1311},{12,3359},{12,799},{12,2847},{12,1823},{12,3871},{12,159},{12,2207},{12,1183},{12,3231},{12,671},{12,2719},{12,1695},{12,3743},{12,415},{12,2463},{12,1439},{12,3487},{12,927},{12,2975},{12,1951},{12,3999},{12,95},{12,2143},{12,1119},{12,3167},
+	{12,607},{12,2655},{12,1631},{12,3679},{12,351},{12,2399},{12,1375},{12,3423},{12,863},{12,2911},{12,1887},{12,3935},{12,223},{12,2271},{12,1247},{12,3295},{12,735},{12,2783},{12,1759},{12,3807},{12,479},{12,2527},{12,1503},{12,3551},{12,991},{12,3039},{12,2015},{12,4063},{12,63},{12,2111},{12,1087},{12,3135},
+	{12,575},{12,2623},{12,1599},{12,3647},{12,319},{12,2367},{12,1343},{12,3391},{12,831},{12,2879},{12,1855},{12,3903},{12,191},{12,2239},{12,1215},{12,3263},{12,703},{12,2751},{12,1727},{12,3775},{12,447},{12,2495},{12,1471},{12,3519},{12,959},{12,3007},{12,1983},{12,4031},{12,127},{12,2175},{12,1151},{12,3199},
+	{12,639},{12,2687},{12,1663},{12,3711},{12,383},{12,2431},{12,1407},{12,3455},{12,895},{12,2943},{12,1919},{12,3967},{10,655},{9,375},{9,247},{9,503},{9,15},{8,231},{8,23},{8,151},{8,87},{8,215},{7,107},{7,27},{7,91},{7,59},{6,3},{6,35},{6,19},{5,21},{4,9},{3,6},
+	{12,255},{0,0},{6,51},{0,0},{0,0},{0,0},{7,123},{0,0},{0,0},{8,55},{0,0},{9,271},{0,0},{12,2303},{12,1279},{12,3327},{12,767},{12,2815},{12,1791},{12,3839},{12,511},{12,2559},{12,1535},{12,3583},{12,1023},{12,3071},{12,2047},{12,4095},{7,7},{0,0},{0,0},{0,0}
+	};
+
+	// A table set of the one-pass encoder: the zlib and dynamic block headers up to their last whole byte, the bits after it and the literal/length codes
+	struct dyn_huff_table
+	{
+		const uint8_t* m_pPrefix;
+		uint32_t m_prefix_size;
+		uint32_t m_bit_buf, m_bit_buf_size;
+		const dyn_huff_code* m_pCodes;
+	};
+
+	static const dyn_huff_table g_dyn_huff_4_table = { g_dyn_huff_4, sizeof(g_dyn_huff_4), DYN_HUFF_4_BITBUF, DYN_HUFF_4_BITBUF_SIZE, g_dyn_huff_4_codes };
+	static const dyn_huff_table g_dyn_huff_4_volume_table = { g_dyn_huff_4_volume, sizeof(g_dyn_huff_4_volume), DYN_HUFF_4_VOLUME_BITBUF, DYN_HUFF_4_VOLUME_BITBUF_SIZE, g_dyn_huff_4_volume_codes };
+
+	static inline const dyn_huff_table& get_dyn_huff_4_table(uint32_t flags)
+	{
+		return (flags & FPNG_ENCODE_VOLUME_TABLES) ? g_dyn_huff_4_volume_table : g_dyn_huff_4_table;
+	}
+
 #define PUT_BITS(bb, ll) do { uint32_t b = bb, l = ll; assert((l) >= 0 && (l) <= 16); assert((b) < (1ULL << (l))); bit_buf |= (((uint64_t)(b)) << bit_buf_size); bit_buf_size += (l); assert(bit_buf_size <= 64); } while(0)
 #define PUT_BITS_CZ(bb, ll) do { uint32_t b = bb, l = ll; assert((l) >= 1 && (l) <= 16); assert((b) < (1ULL << (l))); bit_buf |= (((uint64_t)(b)) << bit_buf_size); bit_buf_size += (l); assert(bit_buf_size <= 64); } while(0)
 
@@ -587,6 +1042,15 @@ namespace fpng
 	} \
 } while(0)
 
+	// What a deflate call writes besides its compressed pixels, so that horizontal strips of an image can be deflated independently and concatenated
+	enum
+	{
+		DEFL_STRIP_ZLIB_HEADER = 1,		// the 2 byte zlib header, only the first strip has it
+		DEFL_STRIP_FINAL_BLOCK = 2,		// BFINAL is set, otherwise the strip ends byte aligned with an empty stored block
+		DEFL_STRIP_ZLIB_ADLER32 = 4,	// the zlib Adler-32 trailer of the strip's data
+		DEFL_STRIP_WHOLE_STREAM = DEFL_STRIP_ZLIB_HEADER | DEFL_STRIP_FINAL_BLOCK | DEFL_STRIP_ZLIB_ADLER32
+	};
+
 	enum
 	{
 		DEFL_MAX_HUFF_TABLES = 3,
@@ -815,22 +1279,27 @@ do { \
 		return true;
 	}
 
-	static uint32_t write_raw_block(const uint8_t* pSrc, uint32_t src_len, uint8_t* pDst, uint32_t dst_buf_size)
+	static uint32_t write_raw_block(const uint8_t* pSrc, uint32_t src_len, uint8_t* pDst, uint32_t dst_buf_size, uint32_t strip_flags = DEFL_STRIP_WHOLE_STREAM)
 	{
-		if (dst_buf_size < 2)
-			return 0;
+		uint32_t dst_ofs = 0;
+
+		if (strip_flags & DEFL_STRIP_ZLIB_HEADER)
+		{
+			if (dst_buf_size < 2)
+				return 0;
 
-		pDst[0] = 0x78;
-		pDst[1] = 0x01;
+			pDst[0] = 0x78;
+			pDst[1] = 0x01;
 
-		uint32_t dst_ofs = 2;
+			dst_ofs = 2;
+		}
 
 		uint32_t src_ofs = 0;
 		while (src_ofs < src_len)
 		{
 			const uint32_t src_remaining = src_len - src_ofs;
 			const uint32_t block_size = minimum<uint32_t>(UINT16_MAX, src_remaining);
-			const bool final_block = (block_size == src_remaining);
+			const bool final_block = (block_size == src_remaining) && (strip_flags & DEFL_STRIP_FINAL_BLOCK);
 
 			if ((dst_ofs + 5 + block_size) > dst_buf_size)
 				return 0;
@@ -849,6 +1318,9 @@ do { \
 			dst_ofs += 5 + block_size;
 		}
 
+		if ((strip_flags & DEFL_STRIP_ZLIB_ADLER32) == 0)
+			return dst_ofs;
+
 		uint32_t src_adler32 = fpng_adler32(pSrc, src_len, FPNG_ADLER32_INIT);
 
 		for (uint32_t i = 0; i < 4; i++)
@@ -907,7 +1379,7 @@ do { \
 	}
 
 #if FPNG_TRAIN_HUFFMAN_TABLES
-	bool create_dynamic_block_prefix(uint64_t* pFreq, uint32_t num_chans, std::vector<uint8_t>& prefix, uint64_t& bit_buf, int &bit_buf_size, uint32_t* pCodes, uint8_t* pCodesizes)
+	bool create_dynamic_block_prefix(const uint64_t* pFreq, uint32_t num_chans, std::vector<uint8_t>& prefix, uint64_t& bit_buf, int &bit_buf_size, uint32_t* pCodes, uint8_t* pCodesizes)
 	{
 		assert((num_chans == 3) || (num_chans == 4));
 		assert(HUFF_COUNTS_SIZE == DEFL_MAX_HUFF_SYMBOLS_0); // must be equal
@@ -930,7 +1402,7 @@ do { \
 				if (f > UINT32_MAX)
 					break;
 
-				lit_freq[i] = (uint32_t)pFreq[i];
+				lit_freq[i] = (uint32_t)f;
 			}
 
 			if (i == DEFL_MAX_HUFF_SYMBOLS_0)
@@ -985,11 +1457,41 @@ do { \
 
 		return true;
 	}
+
+	bool create_huffman_table_source(const uint64_t* pFreq, uint32_t num_chans, const char* pName, std::string& source)
+	{
+		std::vector<uint8_t> prefix;
+		uint64_t bit_buf = 0;
+		int bit_buf_size = 0;
+		uint32_t codes[DEFL_MAX_HUFF_SYMBOLS_0];
+		uint8_t code_sizes[DEFL_MAX_HUFF_SYMBOLS_0];
+		if (!create_dynamic_block_prefix(pFreq, num_chans, prefix, bit_buf, bit_buf_size, codes, code_sizes))
+			return false;
+
+		std::string upper_name(pName);
+		for (char& c : upper_name)
+			if ((c >= 'a') && (c <= 'z'))
+				c = (char)(c - 'a' + 'A');
+
+		// Same layout as the tables above, 32 entries per line
+		source = "\tstatic const uint8_t g_dyn_huff_" + std::string(pName) + "[] = {";
+		for (uint32_t i = 0; i < prefix.size(); i++)
+			source += ((i & 31) ? " " : "\n\t") + std::to_string(prefix[i]) + ((i + 1 < prefix.size()) ? "," : " };\n");
+
+		source += "\tconst uint32_t DYN_HUFF_" + upper_name + "_BITBUF = " + std::to_string(bit_buf) + ", DYN_HUFF_" + upper_name + "_BITBUF_SIZE = " + std::to_string(bit_buf_size) + ";\n";
+
+		source += "\tstatic const dyn_huff_code g_dyn_huff_" + std::string(pName) + "_codes[" + std::to_string(DEFL_MAX_HUFF_SYMBOLS_0) + "] = {";
+		for (uint32_t i = 0; i < DEFL_MAX_HUFF_SYMBOLS_0; i++)
+			source += ((i & 31) ? "," : (i ? ",\n\t" : "\n\t")) + std::string("{") + std::to_string(code_sizes[i]) + "," + std::to_string(codes[i]) + "}";
+		source += "\n\t};\n";
+
+		return true;
+	}
 #endif
 
 	static uint32_t pixel_deflate_dyn_3_rle(
 		const uint8_t* pImg, uint32_t w, uint32_t h,
-		uint8_t* pDst, uint32_t dst_buf_size)
+		uint8_t* pDst, uint32_t dst_buf_size, std::vector<uint32_t>& codes)
 	{
 		const uint32_t bpl = 1 + w * 3;
 
@@ -1005,7 +1507,8 @@ do { \
 		// write BFINAL bit
 		PUT_BITS(1, 1);
 
-		std::vector<uint32_t> codes((w + 1) * h);
+		if (codes.size() < (size_t)(w + 1) * h)
+			codes.resize((size_t)(w + 1) * h);
 		uint32_t* pDst_codes = codes.data();
 
 		uint32_t lit_freq[DEFL_MAX_HUFF_SYMBOLS_0];
@@ -1162,14 +1665,21 @@ do { \
 
 	static uint32_t pixel_deflate_dyn_3_rle_one_pass(
 		const uint8_t* pImg, uint32_t w, uint32_t h,
-		uint8_t* pDst, uint32_t dst_buf_size)
+		uint8_t* pDst, uint32_t dst_buf_size, uint32_t strip_flags = DEFL_STRIP_WHOLE_STREAM)
 	{
 		const uint32_t bpl = 1 + w * 3;
 
-		if (dst_buf_size < sizeof(g_dyn_huff_3))
+		// Strips after the first continue the stream of the previous one, so they start right after the zlib header
+		const uint32_t hdr_ofs = (strip_flags & DEFL_STRIP_ZLIB_HEADER) ? 0 : 2;
+
+		if (dst_buf_size < sizeof(g_dyn_huff_3) - hdr_ofs)
 			return false;
-		memcpy(pDst, g_dyn_huff_3, sizeof(g_dyn_huff_3));
-		uint32_t dst_ofs = sizeof(g_dyn_huff_3);
+		memcpy(pDst, g_dyn_huff_3 + hdr_ofs, sizeof(g_dyn_huff_3) - hdr_ofs);
+		uint32_t dst_ofs = sizeof(g_dyn_huff_3) - hdr_ofs;
+
+		// Clear BFINAL, the first bit after the zlib header, if more strips follow
+		if ((strip_flags & DEFL_STRIP_FINAL_BLOCK) == 0)
+			pDst[2 - hdr_ofs] &= ~1;
 
 		uint64_t bit_buf = DYN_HUFF_3_BITBUF;
 		int bit_buf_size = DYN_HUFF_3_BITBUF_SIZE;
@@ -1177,7 +1687,7 @@ do { \
 		const uint8_t* pSrc = pImg;
 		uint32_t src_ofs = 0;
 
-		uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
+		uint32_t src_adler32 = (strip_flags & DEFL_STRIP_ZLIB_ADLER32) ? fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT) : 0;
 
 		for (uint32_t y = 0; y < h; y++)
 		{
@@ -1248,7 +1758,24 @@ do { \
 
 		PUT_BITS_CZ(g_dyn_huff_3_codes[256].m_code, g_dyn_huff_3_codes[256].m_code_size);
 
-		PUT_BITS_FORCE_FLUSH;
+		if ((strip_flags & DEFL_STRIP_FINAL_BLOCK) == 0)
+		{
+			// Empty non-final stored block, which byte aligns the stream so the next strip's block can simply be appended
+			PUT_BITS(0, 3);
+			PUT_BITS_FORCE_FLUSH;
+
+			if ((dst_ofs + 4) > dst_buf_size)
+				return 0;
+			WRITE_LE32(pDst + dst_ofs, 0xFFFF0000);
+			dst_ofs += 4;
+		}
+		else
+		{
+			PUT_BITS_FORCE_FLUSH;
+		}
+
+		if ((strip_flags & DEFL_STRIP_ZLIB_ADLER32) == 0)
+			return dst_ofs;
 
 		// Write zlib adler32
 		for (uint32_t i = 0; i < 4; i++)
@@ -1264,9 +1791,89 @@ do { \
 		return dst_ofs;
 	}
 
+#if FPNG_AVX2
+	// Compares 8 pixels at a time against the run's pixel
+	FPNG_TARGET_AVX2 static uint32_t rle_match_len_4_avx2(const uint8_t* p, uint32_t lits, uint32_t max_match_len)
+	{
+		const __m256i v = _mm256_set1_epi32((int)lits);
+
+		uint32_t match_len = 4;
+		for (; match_len + 32 <= max_match_len; match_len += 32)
+		{
+			const uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(p + match_len)), v));
+			if (mask != 0xFFFFFFFF)
+			{
+#ifdef _MSC_VER
+				unsigned long first_diff;
+				_BitScanForward(&first_diff, ~mask);
+				return match_len + first_diff;
+#else
+				return match_len + __builtin_ctz(~mask);
+#endif
+			}
+		}
+
+		for (; match_len < max_match_len; match_len += 4)
+			if (READ_LE32(p + match_len) != lits)
+				break;
+
+		return match_len;
+	}
+#endif
+
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
+	static uint32_t rle_match_len_4_sse41(const uint8_t* p, uint32_t lits, uint32_t max_match_len)
+	{
+		const __m128i v = _mm_set1_epi32((int)lits);
+
+		uint32_t match_len = 4;
+		for (; match_len + 16 <= max_match_len; match_len += 16)
+		{
+			const uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)(p + match_len)), v));
+			if (mask != 0xFFFF)
+			{
+#ifdef _MSC_VER
+				unsigned long first_diff;
+				_BitScanForward(&first_diff, ~mask);
+				return match_len + first_diff;
+#else
+				return match_len + __builtin_ctz(~mask);
+#endif
+			}
+		}
+
+		for (; match_len < max_match_len; match_len += 4)
+			if (READ_LE32(p + match_len) != lits)
+				break;
+
+		return match_len;
+	}
+#endif
+
+	// Length in bytes of the run of the RGBA pixel lits starting at p, whose first pixel is already known to match
+	static inline uint32_t rle_match_len_4(const uint8_t* p, uint32_t lits, uint32_t max_match_len)
+	{
+#if FPNG_AVX2
+		if ((max_match_len >= 36) && g_cpu_info.can_use_avx2())
+			return rle_match_len_4_avx2(p, lits, max_match_len);
+#endif
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
+		if ((max_match_len >= 20) && g_cpu_info.can_use_sse41())
+			return rle_match_len_4_sse41(p, lits, max_match_len);
+#endif
+		uint32_t match_len = 4;
+		while (match_len < max_match_len)
+		{
+			if (READ_LE32(p + match_len) != lits)
+				break;
+			match_len += 4;
+		}
+		return match_len;
+	}
+
 	static uint32_t pixel_deflate_dyn_4_rle(
 		const uint8_t* pImg, uint32_t w, uint32_t h,
-		uint8_t* pDst, uint32_t dst_buf_size)
+		uint8_t* pDst, uint32_t dst_buf_size, std::vector<uint64_t>& codes)
 	{
 		const uint32_t bpl = 1 + w * 4;
 
@@ -1282,8 +1889,8 @@ do { \
 		// write BFINAL bit
 		PUT_BITS(1, 1);
 
-		std::vector<uint64_t> codes;
-		codes.resize((w + 1) * h);
+		if (codes.size() < (size_t)(w + 1) * h)
+			codes.resize((size_t)(w + 1) * h);
 		uint64_t* pDst_codes = codes.data();
 
 		uint32_t lit_freq[DEFL_MAX_HUFF_SYMBOLS_0];
@@ -1326,15 +1933,8 @@ do { \
 
 				if (lits == prev_lits)
 				{
-					uint32_t match_len = 4;
 					uint32_t max_match_len = minimum<int>(252, (int)(end_src_ofs - src_ofs));
-
-					while (match_len < max_match_len)
-					{
-						if (READ_LE32(pSrc + src_ofs + match_len) != lits)
-							break;
-						match_len += 4;
-					}
+					uint32_t match_len = rle_match_len_4(pSrc + src_ofs, lits, max_match_len);
 										
 					*pDst_codes++ = match_len - 1;
 
@@ -1448,29 +2048,50 @@ do { \
 
 	static uint32_t pixel_deflate_dyn_4_rle_one_pass(
 		const uint8_t* pImg, uint32_t w, uint32_t h,
-		uint8_t* pDst, uint32_t dst_buf_size)
+		uint8_t* pDst, uint32_t dst_buf_size, const dyn_huff_table& table, uint32_t strip_flags = DEFL_STRIP_WHOLE_STREAM)
 	{
 		const uint32_t bpl = 1 + w * 4;
 
-		if (dst_buf_size < sizeof(g_dyn_huff_4))
-			return false;
-		memcpy(pDst, g_dyn_huff_4, sizeof(g_dyn_huff_4));
-		uint32_t dst_ofs = sizeof(g_dyn_huff_4);
+		// Strips after the first continue the stream of the previous one, so they start right after the zlib header
+		const uint32_t hdr_ofs = (strip_flags & DEFL_STRIP_ZLIB_HEADER) ? 0 : 2;
 
-		uint64_t bit_buf = DYN_HUFF_4_BITBUF;
-		int bit_buf_size = DYN_HUFF_4_BITBUF_SIZE;
+		if (dst_buf_size < table.m_prefix_size - hdr_ofs)
+			return false;
+		memcpy(pDst, table.m_pPrefix + hdr_ofs, table.m_prefix_size - hdr_ofs);
+		uint32_t dst_ofs = table.m_prefix_size - hdr_ofs;
+
+		// Clear BFINAL, the first bit after the zlib header, if more strips follow
+		if ((strip_flags & DEFL_STRIP_FINAL_BLOCK) == 0)
+			pDst[2 - hdr_ofs] &= ~1;
+
+		uint64_t bit_buf = table.m_bit_buf;
+		int bit_buf_size = table.m_bit_buf_size;
+		const dyn_huff_code* pCodes = table.m_pCodes;
+
+		// Runs are coded as matches of up to 252 bytes. The full length match is the same bits every time, so the full length matches of a long run,
+		// like the transparent background of a volume render, are put as many at once as fit into the bit buffer after a flush.
+		const uint32_t FULL_MATCH_LEN = 252, full_adj_match_len = FULL_MATCH_LEN - 3;
+		const dyn_huff_code& full_match_code = pCodes[g_defl_len_sym[full_adj_match_len]];
+		const uint32_t full_match_bits = full_match_code.m_code_size + g_defl_len_extra[full_adj_match_len] + 1;
+		const uint32_t full_matches_per_put = 56 / full_match_bits;
+		uint64_t full_matches = 0;
+		for (uint32_t i = 0; i < full_matches_per_put; i++)
+			full_matches |= (full_match_code.m_code | ((uint64_t)(full_adj_match_len & g_bitmasks[g_defl_len_extra[full_adj_match_len]]) << full_match_code.m_code_size)) << (i * full_match_bits);
 
 		const uint8_t* pSrc = pImg;
 		uint32_t src_ofs = 0;
 
-		uint32_t src_adler32 = fpng_adler32(pImg, bpl * h, FPNG_ADLER32_INIT);
+		// The Adler-32 is summed up to each run of transparent black and continued past it without reading the run again
+		const bool sum_adler32 = (strip_flags & DEFL_STRIP_ZLIB_ADLER32) != 0;
+		uint32_t src_adler32 = FPNG_ADLER32_INIT;
+		uint32_t adler32_ofs = 0;
 
 		for (uint32_t y = 0; y < h; y++)
 		{
 			const uint32_t end_src_ofs = src_ofs + bpl;
 
 			const uint32_t filter_lit = pSrc[src_ofs++];
-			PUT_BITS_CZ(g_dyn_huff_4_codes[filter_lit].m_code, g_dyn_huff_4_codes[filter_lit].m_code_size);
+			PUT_BITS_CZ(pCodes[filter_lit].m_code, pCodes[filter_lit].m_code_size);
 
 			PUT_BITS_FLUSH;
 
@@ -1478,16 +2099,16 @@ do { \
 			{
 				uint32_t lits = READ_LE32(pSrc + src_ofs);
 
-				PUT_BITS_CZ(g_dyn_huff_4_codes[lits & 0xFF].m_code, g_dyn_huff_4_codes[lits & 0xFF].m_code_size);
-				PUT_BITS_CZ(g_dyn_huff_4_codes[(lits >> 8) & 0xFF].m_code, g_dyn_huff_4_codes[(lits >> 8) & 0xFF].m_code_size);
-				PUT_BITS_CZ(g_dyn_huff_4_codes[(lits >> 16) & 0xFF].m_code, g_dyn_huff_4_codes[(lits >> 16) & 0xFF].m_code_size);
+				PUT_BITS_CZ(pCodes[lits & 0xFF].m_code, pCodes[lits & 0xFF].m_code_size);
+				PUT_BITS_CZ(pCodes[(lits >> 8) & 0xFF].m_code, pCodes[(lits >> 8) & 0xFF].m_code_size);
+				PUT_BITS_CZ(pCodes[(lits >> 16) & 0xFF].m_code, pCodes[(lits >> 16) & 0xFF].m_code_size);
 
 				if (bit_buf_size >= 49)
 				{
 					PUT_BITS_FLUSH;
 				}
 				
-				PUT_BITS_CZ(g_dyn_huff_4_codes[(lits >> 24)].m_code, g_dyn_huff_4_codes[(lits >> 24)].m_code_size);
+				PUT_BITS_CZ(pCodes[(lits >> 24)].m_code, pCodes[(lits >> 24)].m_code_size);
 
 				src_ofs += 4;
 				
@@ -1502,32 +2123,51 @@ do { \
 								
 				if (lits == prev_lits)
 				{
-					uint32_t match_len = 4;
-					uint32_t max_match_len = minimum<int>(252, (int)(end_src_ofs - src_ofs));
+					// Measure the whole run up to the end of the row at once
+					uint32_t match_len = rle_match_len_4(pSrc + src_ofs, lits, end_src_ofs - src_ofs);
 
-					while (match_len < max_match_len)
+					if (match_len >= FULL_MATCH_LEN)
 					{
-						if (READ_LE32(pSrc + src_ofs + match_len) != lits)
-							break;
-						match_len += 4;
+						if (!lits && sum_adler32)
+						{
+							src_adler32 = adler32_append_zeros(fpng_adler32(pSrc + adler32_ofs, src_ofs - adler32_ofs, src_adler32), match_len);
+							adler32_ofs = src_ofs + match_len;
+						}
+
+						uint32_t num_full_matches = match_len / FULL_MATCH_LEN;
+						src_ofs += num_full_matches * FULL_MATCH_LEN;
+						match_len -= num_full_matches * FULL_MATCH_LEN;
+
+						while (num_full_matches)
+						{
+							const uint32_t n = minimum(num_full_matches, full_matches_per_put);
+							bit_buf |= ((n == full_matches_per_put) ? full_matches : (full_matches & ((1ULL << (n * full_match_bits)) - 1))) << bit_buf_size;
+							bit_buf_size += n * full_match_bits;
+							PUT_BITS_FLUSH;
+							num_full_matches -= n;
+						}
+
+						// The run ended on a full length match
+						if (!match_len)
+							continue;
 					}
 
 					uint32_t adj_match_len = match_len - 3;
 
-					const uint32_t match_code_bits = g_dyn_huff_4_codes[g_defl_len_sym[adj_match_len]].m_code_size;
+					const uint32_t match_code_bits = pCodes[g_defl_len_sym[adj_match_len]].m_code_size;
 					const uint32_t len_extra_bits = g_defl_len_extra[adj_match_len];
 
 					if (match_len == 4)
 					{
 						// This check is optional - see if just encoding 4 literals would be cheaper than using a short match.
-						uint32_t lit_bits = g_dyn_huff_4_codes[lits & 0xFF].m_code_size + g_dyn_huff_4_codes[(lits >> 8) & 0xFF].m_code_size + 
-							g_dyn_huff_4_codes[(lits >> 16) & 0xFF].m_code_size + g_dyn_huff_4_codes[(lits >> 24)].m_code_size;
+						uint32_t lit_bits = pCodes[lits & 0xFF].m_code_size + pCodes[(lits >> 8) & 0xFF].m_code_size + 
+							pCodes[(lits >> 16) & 0xFF].m_code_size + pCodes[(lits >> 24)].m_code_size;
 						
 						if ((match_code_bits + len_extra_bits + 1) > lit_bits)
 							goto do_literals;
 					}
 
-					PUT_BITS_CZ(g_dyn_huff_4_codes[g_defl_len_sym[adj_match_len]].m_code, match_code_bits);
+					PUT_BITS_CZ(pCodes[g_defl_len_sym[adj_match_len]].m_code, match_code_bits);
 					PUT_BITS(adj_match_len & g_bitmasks[g_defl_len_extra[adj_match_len]], len_extra_bits + 1); // up to 6 bits, +1 for the match distance Huff code which is always 0
 
 					src_ofs += match_len;
@@ -1535,16 +2175,16 @@ do { \
 				else
 				{
 do_literals:
-					PUT_BITS_CZ(g_dyn_huff_4_codes[lits & 0xFF].m_code, g_dyn_huff_4_codes[lits & 0xFF].m_code_size);
-					PUT_BITS_CZ(g_dyn_huff_4_codes[(lits >> 8) & 0xFF].m_code, g_dyn_huff_4_codes[(lits >> 8) & 0xFF].m_code_size);
-					PUT_BITS_CZ(g_dyn_huff_4_codes[(lits >> 16) & 0xFF].m_code, g_dyn_huff_4_codes[(lits >> 16) & 0xFF].m_code_size);
+					PUT_BITS_CZ(pCodes[lits & 0xFF].m_code, pCodes[lits & 0xFF].m_code_size);
+					PUT_BITS_CZ(pCodes[(lits >> 8) & 0xFF].m_code, pCodes[(lits >> 8) & 0xFF].m_code_size);
+					PUT_BITS_CZ(pCodes[(lits >> 16) & 0xFF].m_code, pCodes[(lits >> 16) & 0xFF].m_code_size);
 
 					if (bit_buf_size >= 49)
 					{
 						PUT_BITS_FLUSH;
 					}
 
-					PUT_BITS_CZ(g_dyn_huff_4_codes[(lits >> 24)].m_code, g_dyn_huff_4_codes[(lits >> 24)].m_code_size);
+					PUT_BITS_CZ(pCodes[(lits >> 24)].m_code, pCodes[(lits >> 24)].m_code_size);
 
 					src_ofs += 4;
 					
@@ -1561,9 +2201,28 @@ do_literals:
 
 		assert(bit_buf_size <= 7);
 
-		PUT_BITS_CZ(g_dyn_huff_4_codes[256].m_code, g_dyn_huff_4_codes[256].m_code_size);
+		PUT_BITS_CZ(pCodes[256].m_code, pCodes[256].m_code_size);
 
-		PUT_BITS_FORCE_FLUSH;
+		if ((strip_flags & DEFL_STRIP_FINAL_BLOCK) == 0)
+		{
+			// Empty non-final stored block, which byte aligns the stream so the next strip's block can simply be appended
+			PUT_BITS(0, 3);
+			PUT_BITS_FORCE_FLUSH;
+
+			if ((dst_ofs + 4) > dst_buf_size)
+				return 0;
+			WRITE_LE32(pDst + dst_ofs, 0xFFFF0000);
+			dst_ofs += 4;
+		}
+		else
+		{
+			PUT_BITS_FORCE_FLUSH;
+		}
+
+		if (!sum_adler32)
+			return dst_ofs;
+
+		src_adler32 = fpng_adler32(pSrc + adler32_ofs, src_ofs - adler32_ofs, src_adler32);
 
 		// Write zlib adler32
 		for (uint32_t i = 0; i < 4; i++)
@@ -1579,16 +2238,211 @@ do_literals:
 		return dst_ofs;
 	}
 
-	static void vector_append(std::vector<uint8_t>& buf, const void* pData, size_t len)
+	const uint32_t PNG_HEADER_SIZE = 58;
+
+	// Writes the PNG signature, IHDR chunk, fdEC chunk, and the length and type of the IDAT chunk
+	static void write_png_header(uint8_t* pDst, uint32_t w, uint32_t h, uint32_t num_chans, uint32_t idat_len)
+	{
+		static const uint8_t s_color_type[] = { 0x00, 0x00, 0x04, 0x02, 0x06 };
+
+		uint8_t pnghdr[PNG_HEADER_SIZE] = {
+			0x89,0x50,0x4e,0x47,0x0d,0x0a,0x1a,0x0a,   // PNG sig
+			0x00,0x00,0x00,0x0d, 'I','H','D','R',  // IHDR chunk len, type
+			0,0,(uint8_t)(w >> 8),(uint8_t)w, // width
+			0,0,(uint8_t)(h >> 8),(uint8_t)h, // height
+			8,   //bit_depth
+			s_color_type[num_chans], // color_type
+			0, // compression
+			0, // filter
+			0, // interlace
+			0, 0, 0, 0, // IHDR crc32
+			0, 0, 0, 5, 'f', 'd', 'E', 'C', 82, 36, 147, 227, FPNG_FDEC_VERSION,   0xE5, 0xAB, 0x62, 0x99, // our custom private, ancillary, do not copy, fdEC chunk
+			(uint8_t)(idat_len >> 24),(uint8_t)(idat_len >> 16),(uint8_t)(idat_len >> 8),(uint8_t)idat_len, 'I','D','A','T' // IDATA chunk len, type
+		};
+
+		// Compute IHDR CRC32
+		uint32_t c = (uint32_t)fpng_crc32(pnghdr + 12, 17, FPNG_CRC32_INIT);
+		for (uint32_t i = 0; i < 4; ++i, c <<= 8)
+			((uint8_t*)(pnghdr + 29))[i] = (uint8_t)(c >> 24);
+
+		memcpy(pDst, pnghdr, PNG_HEADER_SIZE);
+	}
+
+#if FPNG_AVX2
+	FPNG_TARGET_AVX2 static void filter_up_avx2(uint8_t* pDst, const uint8_t* pSrc, const uint8_t* pPrev_src, uint32_t bytes_to_process)
 	{
-		if (len)
+		uint32_t ofs = 0;
+		for (; bytes_to_process >= 32; bytes_to_process -= 32, ofs += 32)
+			_mm256_storeu_si256((__m256i*)(pDst + ofs), _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(pSrc + ofs)), _mm256_loadu_si256((const __m256i*)(pPrev_src + ofs))));
+
+		for (; bytes_to_process; bytes_to_process--, ofs++)
+			pDst[ofs] = (uint8_t)(pSrc[ofs] - pPrev_src[ofs]);
+	}
+#endif
+
+	// PNG filter types
+	enum
+	{
+		FILTER_NONE = 0,
+		FILTER_SUB = 1,
+		FILTER_UP = 2,
+		FILTER_AVERAGE = 3,
+		FILTER_PAETH = 4
+	};
+
+	static inline int paeth_predict(int a, int b, int c)
+	{
+		const int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+		if ((pa <= pb) && (pa <= pc))
+			return a;
+		return (pb <= pc) ? b : c;
+	}
+
+	// Filtered byte at ofs of a row, the bytes left of the first pixel and above the first row are 0
+	template<uint32_t FILTER>
+	static inline uint8_t filter_byte(const uint8_t* pSrc, const uint8_t* pPrev_src, uint32_t ofs, uint32_t bpp)
+	{
+		const int x = pSrc[ofs];
+		const int a = (ofs >= bpp) ? pSrc[ofs - bpp] : 0;
+		const int b = pPrev_src ? pPrev_src[ofs] : 0;
+		const int c = ((ofs >= bpp) && pPrev_src) ? pPrev_src[ofs - bpp] : 0;
+
+		switch (FILTER)
 		{
-			size_t l = buf.size();
-			buf.resize(l + len);
-			memcpy(buf.data() + l, pData, len);
+		case FILTER_SUB: return (uint8_t)(x - a);
+		case FILTER_UP: return (uint8_t)(x - b);
+		case FILTER_AVERAGE: return (uint8_t)(x - ((a + b) >> 1));
+		case FILTER_PAETH: return (uint8_t)(x - paeth_predict(a, b, c));
+		default: return (uint8_t)x;
 		}
 	}
-		
+
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
+	// Paeth predictor of 8 bytes widened to 16 bits
+	static inline __m128i paeth_predict_sse41(__m128i a, __m128i b, __m128i c)
+	{
+		const __m128i pa = _mm_abs_epi16(_mm_sub_epi16(b, c)), pb = _mm_abs_epi16(_mm_sub_epi16(a, c));
+		const __m128i pc = _mm_abs_epi16(_mm_add_epi16(_mm_sub_epi16(a, c), _mm_sub_epi16(b, c)));
+
+		const __m128i not_a = _mm_cmpgt_epi16(pa, _mm_min_epi16(pb, pc)), not_b = _mm_cmpgt_epi16(pb, pc);
+		return _mm_blendv_epi8(a, _mm_blendv_epi8(b, c, not_b), not_a);
+	}
+
+	// 16 filtered bytes at ofs >= bpp of a row with a previous row, except for FILTER_NONE and FILTER_SUB
+	template<uint32_t FILTER>
+	static inline __m128i filter_16_sse41(const uint8_t* pSrc, const uint8_t* pPrev_src, uint32_t ofs, uint32_t bpp)
+	{
+		const __m128i x = _mm_loadu_si128((const __m128i*)(pSrc + ofs));
+
+		switch (FILTER)
+		{
+		case FILTER_SUB:
+			return _mm_sub_epi8(x, _mm_loadu_si128((const __m128i*)(pSrc + ofs - bpp)));
+		case FILTER_UP:
+			return _mm_sub_epi8(x, _mm_loadu_si128((const __m128i*)(pPrev_src + ofs)));
+		case FILTER_AVERAGE:
+		{
+			// _mm_avg_epu8() rounds up, the filter rounds down
+			const __m128i a = _mm_loadu_si128((const __m128i*)(pSrc + ofs - bpp)), b = _mm_loadu_si128((const __m128i*)(pPrev_src + ofs));
+			return _mm_sub_epi8(x, _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1))));
+		}
+		case FILTER_PAETH:
+		{
+			const __m128i a = _mm_loadu_si128((const __m128i*)(pSrc + ofs - bpp)), b = _mm_loadu_si128((const __m128i*)(pPrev_src + ofs));
+			const __m128i c = _mm_loadu_si128((const __m128i*)(pPrev_src + ofs - bpp)), zero = _mm_setzero_si128();
+			const __m128i lo = paeth_predict_sse41(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+			const __m128i hi = paeth_predict_sse41(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+			return _mm_sub_epi8(x, _mm_packus_epi16(lo, hi));
+		}
+		default:
+			return x;
+		}
+	}
+#endif
+
+	// Filters the bpl bytes of a row into pDst if STORE is set, otherwise returns the sum of the filtered bytes taken as signed magnitudes,
+	// the minimum sum of absolute differences heuristic of the PNG specification
+	template<uint32_t FILTER, bool STORE>
+	static uint64_t filter_row(const uint8_t* pSrc, const uint8_t* pPrev_src, uint32_t bpl, uint32_t bpp, uint8_t* pDst)
+	{
+		uint64_t sum = 0;
+		uint32_t ofs = 0;
+
+		// The first pixel has no left neighbour
+		for (; ofs < minimum(bpp, bpl); ofs++)
+		{
+			const uint8_t d = filter_byte<FILTER>(pSrc, pPrev_src, ofs, bpp);
+			if (STORE)
+				pDst[ofs] = d;
+			else
+				sum += abs((int8_t)d);
+		}
+
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
+		if ((g_cpu_info.can_use_sse41()) && ((pPrev_src) || (FILTER <= FILTER_SUB)))
+		{
+			__m128i sums = _mm_setzero_si128();
+			for (; ofs + 16 <= bpl; ofs += 16)
+			{
+				const __m128i d = filter_16_sse41<FILTER>(pSrc, pPrev_src, ofs, bpp);
+				if (STORE)
+					_mm_storeu_si128((__m128i*)(pDst + ofs), d);
+				else
+					sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_abs_epi8(d), _mm_setzero_si128()));
+			}
+			uint64_t lane_sums[2];
+			_mm_storeu_si128((__m128i*)lane_sums, sums);
+			sum += lane_sums[0] + lane_sums[1];
+		}
+#endif
+
+		for (; ofs < bpl; ofs++)
+		{
+			const uint8_t d = filter_byte<FILTER>(pSrc, pPrev_src, ofs, bpp);
+			if (STORE)
+				pDst[ofs] = d;
+			else
+				sum += abs((int8_t)d);
+		}
+
+		return sum;
+	}
+
+	// Picks the filter of a row with the minimum sum heuristic. Up is scored first and kept on ties, it's what the Huffman tables
+	// of the one pass deflaters were trained on. The first row chooses between None and Sub, the others behave like them there.
+	static uint32_t choose_filter(uint32_t num_chans, uint32_t bpl, const uint8_t* pSrc, const uint8_t* pPrev_src)
+	{
+		if (!pPrev_src)
+			return (filter_row<FILTER_SUB, false>(pSrc, nullptr, bpl, num_chans, nullptr) < filter_row<FILTER_NONE, false>(pSrc, nullptr, bpl, num_chans, nullptr)) ? FILTER_SUB : FILTER_NONE;
+
+		uint32_t best_filter = FILTER_UP;
+		uint64_t best_sum = filter_row<FILTER_UP, false>(pSrc, pPrev_src, bpl, num_chans, nullptr);
+
+		// Nothing beats a row that equals the previous one
+		if (!best_sum)
+			return best_filter;
+
+		const uint64_t sub_sum = filter_row<FILTER_SUB, false>(pSrc, pPrev_src, bpl, num_chans, nullptr);
+		if (sub_sum < best_sum)
+		{
+			best_filter = FILTER_SUB;
+			best_sum = sub_sum;
+		}
+
+		const uint64_t paeth_sum = filter_row<FILTER_PAETH, false>(pSrc, pPrev_src, bpl, num_chans, nullptr);
+		if (paeth_sum < best_sum)
+		{
+			best_filter = FILTER_PAETH;
+			best_sum = paeth_sum;
+		}
+
+		const uint64_t average_sum = filter_row<FILTER_AVERAGE, false>(pSrc, pPrev_src, bpl, num_chans, nullptr);
+		if (average_sum < best_sum)
+			best_filter = FILTER_AVERAGE;
+
+		return best_filter;
+	}
+
 	static void apply_filter(uint32_t filter, int w, int h, uint32_t num_chans, uint32_t bpl, const uint8_t* pSrc, const uint8_t* pPrev_src, uint8_t* pDst)
 	{
 		(void)h;
@@ -1609,6 +2463,11 @@ do_literals:
 			// Previous scanline
 			*pDst++ = 2;
 
+#if FPNG_AVX2
+			if (g_cpu_info.can_use_avx2())
+				filter_up_avx2(pDst, pSrc, pPrev_src, w * num_chans);
+			else
+#endif
 #if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
 			if (g_cpu_info.can_use_sse41())
 			{
@@ -1653,14 +2512,92 @@ do_literals:
 
 			break;
 		}
+		case FILTER_SUB:
+		{
+			*pDst++ = FILTER_SUB;
+			filter_row<FILTER_SUB, true>(pSrc, pPrev_src, bpl, num_chans, pDst);
+			break;
+		}
+		case FILTER_AVERAGE:
+		{
+			assert(pPrev_src);
+			*pDst++ = FILTER_AVERAGE;
+			filter_row<FILTER_AVERAGE, true>(pSrc, pPrev_src, bpl, num_chans, pDst);
+			break;
+		}
+		case FILTER_PAETH:
+		{
+			assert(pPrev_src);
+			*pDst++ = FILTER_PAETH;
+			filter_row<FILTER_PAETH, true>(pSrc, pPrev_src, bpl, num_chans, pDst);
+			break;
+		}
 		default:
 			assert(0);
 			break;
 		}
 	}
 
+	// Filters a row with Up (None for the first row), or with the filter choose_filter() picks if FPNG_ENCODE_ADAPTIVE_FILTERS is set
+	static inline void filter_scanline(uint32_t flags, int w, int h, uint32_t num_chans, uint32_t bpl, const uint8_t* pSrc, const uint8_t* pPrev_src, uint8_t* pDst)
+	{
+		uint32_t filter = pPrev_src ? FILTER_UP : FILTER_NONE;
+		if (flags & FPNG_ENCODE_ADAPTIVE_FILTERS)
+			filter = choose_filter(num_chans, bpl, pSrc, pPrev_src);
+
+		apply_filter(filter, w, h, num_chans, bpl, pSrc, pPrev_src, pDst);
+	}
+
 	bool fpng_encode_image_to_memory(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, std::vector<uint8_t>& out_buf, uint32_t flags)
 	{
+		return fpng_encode_image_to_memory(pImage, w, h, num_chans, (int64_t)w * num_chans, out_buf, flags);
+	}
+
+	bool fpng_encode_image_to_memory(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, std::vector<uint8_t>& out_buf, uint32_t flags)
+	{
+		return fpng_encode_image_to_memory_parallel(pImage, w, h, num_chans, row_pitch, out_buf, flags, 1);
+	}
+
+	bool fpng_encode_image_to_memory_parallel(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, std::vector<uint8_t>& out_buf, uint32_t flags, uint32_t num_threads)
+	{
+		fpng_encoder encoder;
+		if (!encoder.encode_image(pImage, w, h, num_chans, row_pitch, flags, num_threads))
+			return false;
+
+		encoder.take_png(out_buf);
+		return true;
+	}
+
+	void fpng_encoder::take_png(std::vector<uint8_t>& out_buf)
+	{
+		out_buf.swap(m_out);
+		out_buf.resize(m_png_size);
+		m_out.clear();
+		m_png_size = 0;
+	}
+
+	void fpng_encoder::clear()
+	{
+		std::vector<uint8_t>().swap(m_filtered);
+		std::vector<uint8_t>().swap(m_out);
+		std::vector<strip>().swap(m_strips);
+		std::vector<uint32_t>().swap(m_codes_3);
+		std::vector<uint64_t>().swap(m_codes_4);
+		m_png_size = 0;
+	}
+
+	size_t fpng_encoder::get_memory_size() const
+	{
+		size_t size = m_filtered.capacity() + m_out.capacity() + m_codes_3.capacity() * sizeof(uint32_t) + m_codes_4.capacity() * sizeof(uint64_t);
+		for (const strip& st : m_strips)
+			size += st.m_defl.capacity();
+		return size;
+	}
+
+	bool fpng_encoder::encode_image(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, uint32_t flags, uint32_t num_threads)
+	{
+		m_png_size = 0;
+
 		if (!endian_check())
 		{
 			assert(0);
@@ -1679,30 +2616,58 @@ do_literals:
 			return false;
 		}
 
+		// Rows may overlap if the pitch is smaller than a row
+		if ((uint64_t)(row_pitch < 0 ? -row_pitch : row_pitch) < (uint64_t)w * num_chans)
+		{
+			assert(0);
+			return false;
+		}
+
+		// Fewer rows make the per strip block header and stored block too costly
+		const uint32_t MIN_STRIP_ROWS = 32;
+
+		const uint32_t num_strips = minimum<uint32_t>(get_num_threads(num_threads), h / MIN_STRIP_ROWS);
+
+		// Per file Huffman tables and raw blocks are left to the single threaded encoder, which also takes over if a strip didn't compress
+		if ((num_strips > 1) && ((flags & (FPNG_ENCODE_SLOWER | FPNG_FORCE_UNCOMPRESSED)) == 0))
+		{
+			if (encode_strips(pImage, w, h, num_chans, row_pitch, flags, num_strips))
+				return true;
+		}
+
+		return encode_serial(pImage, w, h, num_chans, row_pitch, flags);
+	}
+
+	bool fpng_encoder::encode_serial(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, uint32_t flags)
+	{
 		int i, bpl = w * num_chans;
 		uint32_t y;
 
-		std::vector<uint8_t> temp_buf;
-		temp_buf.resize((bpl + 1) * h + 7);
+		const uint32_t filtered_size = (bpl + 1) * h;
+		if (m_filtered.size() < filtered_size + 7)
+			m_filtered.resize(filtered_size + 7);
+		memset(&m_filtered[filtered_size], 0, 7);
 		uint32_t temp_buf_ofs = 0;
 
 		for (y = 0; y < h; ++y)
 		{
-			const uint8_t* pSrc = (uint8_t*)pImage + y * bpl;
-			const uint8_t* pPrev_src = y ? ((uint8_t*)pImage + (y - 1) * bpl) : nullptr;
+			const uint8_t* pSrc = (const uint8_t*)pImage + (int64_t)y * row_pitch;
+			const uint8_t* pPrev_src = y ? (pSrc - row_pitch) : nullptr;
 
-			uint8_t* pDst = &temp_buf[temp_buf_ofs];
+			uint8_t* pDst = &m_filtered[temp_buf_ofs];
 
-			apply_filter(y ? 2 : 0, w, h, num_chans, bpl, pSrc, pPrev_src, pDst);
+			filter_scanline(flags, w, h, num_chans, bpl, pSrc, pPrev_src, pDst);
 
 			temp_buf_ofs += 1 + bpl;
 		}
 
-		const uint32_t PNG_HEADER_SIZE = 58;
-				
 		uint32_t out_ofs = PNG_HEADER_SIZE;
-				
-		out_buf.resize((out_ofs + (bpl + 1) * h + 7) & ~7);
+
+		// Room for raw blocks, which is more than the compressed data may take, and the IDAT CRC-32 and IEND chunk
+		const uint32_t defl_buf_size = ((out_ofs + filtered_size + 7) & ~7) - out_ofs;
+		const size_t raw_buf_size = 6 + (size_t)filtered_size + ((filtered_size + 65534) / 65535) * 5;
+		if (m_out.size() < out_ofs + maximum<size_t>(defl_buf_size, raw_buf_size) + 16)
+			m_out.resize(out_ofs + maximum<size_t>(defl_buf_size, raw_buf_size) + 16);
 
 		uint32_t defl_size = 0;
 		if ((flags & FPNG_FORCE_UNCOMPRESSED) == 0)
@@ -1710,16 +2675,16 @@ do_literals:
 			if (num_chans == 3)
 			{
 				if (flags & FPNG_ENCODE_SLOWER)
-					defl_size = pixel_deflate_dyn_3_rle(temp_buf.data(), w, h, &out_buf[out_ofs], (uint32_t)out_buf.size() - out_ofs);
+					defl_size = pixel_deflate_dyn_3_rle(m_filtered.data(), w, h, &m_out[out_ofs], defl_buf_size, m_codes_3);
 				else
-					defl_size = pixel_deflate_dyn_3_rle_one_pass(temp_buf.data(), w, h, &out_buf[out_ofs], (uint32_t)out_buf.size() - out_ofs);
+					defl_size = pixel_deflate_dyn_3_rle_one_pass(m_filtered.data(), w, h, &m_out[out_ofs], defl_buf_size);
 			}
 			else
 			{
 				if (flags & FPNG_ENCODE_SLOWER)
-					defl_size = pixel_deflate_dyn_4_rle(temp_buf.data(), w, h, &out_buf[out_ofs], (uint32_t)out_buf.size() - out_ofs);
+					defl_size = pixel_deflate_dyn_4_rle(m_filtered.data(), w, h, &m_out[out_ofs], defl_buf_size, m_codes_4);
 				else
-					defl_size = pixel_deflate_dyn_4_rle_one_pass(temp_buf.data(), w, h, &out_buf[out_ofs], (uint32_t)out_buf.size() - out_ofs);
+					defl_size = pixel_deflate_dyn_4_rle_one_pass(m_filtered.data(), w, h, &m_out[out_ofs], defl_buf_size, get_dyn_huff_4_table(flags));
 			}
 		}
 
@@ -1733,20 +2698,18 @@ do_literals:
 
 			for (y = 0; y < h; ++y)
 			{
-				const uint8_t* pSrc = (uint8_t*)pImage + y * bpl;
+				const uint8_t* pSrc = (const uint8_t*)pImage + (int64_t)y * row_pitch;
 
-				uint8_t* pDst = &temp_buf[temp_buf_ofs];
+				uint8_t* pDst = &m_filtered[temp_buf_ofs];
 
 				apply_filter(0, w, h, num_chans, bpl, pSrc, nullptr, pDst);
 
 				temp_buf_ofs += 1 + bpl;
 			}
 
-			assert(temp_buf_ofs <= temp_buf.size());
-						
-			out_buf.resize(out_ofs + 6 + temp_buf_ofs + ((temp_buf_ofs + 65534) / 65535) * 5);
+			assert(temp_buf_ofs <= m_filtered.size());
 
-			uint32_t raw_size = write_raw_block(temp_buf.data(), (uint32_t)temp_buf_ofs, out_buf.data() + out_ofs, (uint32_t)out_buf.size() - out_ofs);
+			uint32_t raw_size = write_raw_block(m_filtered.data(), (uint32_t)temp_buf_ofs, m_out.data() + out_ofs, (uint32_t)raw_buf_size);
 			if (!raw_size)
 			{
 				// Somehow we miscomputed the size of the output buffer.
@@ -1757,51 +2720,346 @@ do_literals:
 			zlib_size = raw_size;
 		}
 		
-		assert((out_ofs + zlib_size) <= out_buf.size());
-
-		out_buf.resize(out_ofs + zlib_size);
+		assert((out_ofs + zlib_size + 16) <= m_out.size());
 
-		const uint32_t idat_len = (uint32_t)out_buf.size() - PNG_HEADER_SIZE;
+		const uint32_t idat_len = zlib_size;
 
 		// Write real PNG header, fdEC chunk, and the beginning of the IDAT chunk
+		write_png_header(m_out.data(), w, h, num_chans, idat_len);
+
+		// Write IDAT chunk's CRC32 and a 0 length IEND chunk
+		uint8_t* pIdat_end = m_out.data() + out_ofs + zlib_size;
+		memcpy(pIdat_end, "\0\0\0\0\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82", 16); // IDAT CRC32, followed by the IEND chunk
+
+		// Compute IDAT crc32
+		uint32_t c = (uint32_t)fpng_crc32(m_out.data() + PNG_HEADER_SIZE - 4, idat_len + 4, FPNG_CRC32_INIT);
+		
+		for (i = 0; i < 4; ++i, c <<= 8)
+			pIdat_end[i] = (uint8_t)(c >> 24);
+
+		m_png_size = out_ofs + zlib_size + 16;
+		return true;
+	}
+
+	bool fpng_encoder::encode_strips(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, uint32_t flags, uint32_t num_strips)
+	{
+		const uint32_t bpl = w * num_chans;
+
+		if (m_strips.size() < num_strips)
+			m_strips.resize(num_strips);
+
+		// One filtered copy of the image, which each strip fills for its own rows
+		const uint32_t filtered_size = (bpl + 1) * h;
+		if (m_filtered.size() < filtered_size + 7)
+			m_filtered.resize(filtered_size + 7);
+		memset(&m_filtered[filtered_size], 0, 7);
+
+		auto encode_strip = [&](uint32_t strip_index)
+		{
+			strip& st = m_strips[strip_index];
+			st.m_first_row = (uint32_t)(((uint64_t)h * strip_index) / num_strips);
+			st.m_num_rows = (uint32_t)(((uint64_t)h * (strip_index + 1)) / num_strips) - st.m_first_row;
+
+			uint8_t* pFiltered = &m_filtered[(size_t)(bpl + 1) * st.m_first_row];
+			for (uint32_t y = st.m_first_row; y < st.m_first_row + st.m_num_rows; ++y)
+			{
+				// The first row of a strip is still filtered against the last row of the previous strip, only the deflate streams are independent
+				const uint8_t* pSrc = (const uint8_t*)pImage + (int64_t)y * row_pitch;
+				filter_scanline(flags, w, h, num_chans, bpl, pSrc, y ? (pSrc - row_pitch) : nullptr, pFiltered + (size_t)(bpl + 1) * (y - st.m_first_row));
+			}
+
+			const uint32_t strip_filtered_size = (bpl + 1) * st.m_num_rows;
+			st.m_adler32 = fpng_adler32(pFiltered, strip_filtered_size, FPNG_ADLER32_INIT);
+
+			uint32_t strip_flags = 0;
+			if (strip_index == 0)
+				strip_flags |= DEFL_STRIP_ZLIB_HEADER;
+			if (strip_index == num_strips - 1)
+				strip_flags |= DEFL_STRIP_FINAL_BLOCK;
+
+			// Same bound as the single threaded encoder, plus the room PUT_BITS_FLUSH needs and the stored block
+			const uint32_t defl_buf_size = (strip_filtered_size + PNG_HEADER_SIZE + 16 + 7) & ~7;
+			if (st.m_defl.size() < defl_buf_size)
+				st.m_defl.resize(defl_buf_size);
+			if (num_chans == 3)
+				st.m_defl_size = pixel_deflate_dyn_3_rle_one_pass(pFiltered, w, st.m_num_rows, st.m_defl.data(), defl_buf_size, strip_flags);
+			else
+				st.m_defl_size = pixel_deflate_dyn_4_rle_one_pass(pFiltered, w, st.m_num_rows, st.m_defl.data(), defl_buf_size, get_dyn_huff_4_table(flags), strip_flags);
+
+			st.m_defl_crc32 = st.m_defl_size ? fpng_crc32(st.m_defl.data(), st.m_defl_size, FPNG_CRC32_INIT) : 0;
+		};
+
+		run_parallel(num_strips, encode_strip);
+
+		uint64_t zlib_size = 4;
+		for (uint32_t strip_index = 0; strip_index < num_strips; strip_index++)
 		{
-			static const uint8_t s_color_type[] = { 0x00, 0x00, 0x04, 0x02, 0x06 };
+			// A strip that didn't compress; the single threaded encoder falls back to raw blocks for the whole image
+			if (!m_strips[strip_index].m_defl_size)
+				return false;
+			zlib_size += m_strips[strip_index].m_defl_size;
+		}
 
-			uint8_t pnghdr[58] = { 
-				0x89,0x50,0x4e,0x47,0x0d,0x0a,0x1a,0x0a,   // PNG sig
-				0x00,0x00,0x00,0x0d, 'I','H','D','R',  // IHDR chunk len, type
-			    0,0,(uint8_t)(w >> 8),(uint8_t)w, // width
-				0,0,(uint8_t)(h >> 8),(uint8_t)h, // height
-				8,   //bit_depth
-				s_color_type[num_chans], // color_type
-				0, // compression
-				0, // filter
-				0, // interlace
-				0, 0, 0, 0, // IHDR crc32
-				0, 0, 0, 5, 'f', 'd', 'E', 'C', 82, 36, 147, 227, FPNG_FDEC_VERSION,   0xE5, 0xAB, 0x62, 0x99, // our custom private, ancillary, do not copy, fdEC chunk
-			  (uint8_t)(idat_len >> 24),(uint8_t)(idat_len >> 16),(uint8_t)(idat_len >> 8),(uint8_t)idat_len, 'I','D','A','T' // IDATA chunk len, type
-			}; 
+		if (zlib_size > UINT32_MAX - PNG_HEADER_SIZE - 16)
+			return false;
+
+		if (m_out.size() < PNG_HEADER_SIZE + (size_t)zlib_size + 16)
+			m_out.resize(PNG_HEADER_SIZE + (size_t)zlib_size + 16);
+
+		uint32_t out_ofs = PNG_HEADER_SIZE;
+		uint32_t adler32 = FPNG_ADLER32_INIT;
 
-			// Compute IHDR CRC32
-			uint32_t c = (uint32_t)fpng_crc32(pnghdr + 12, 17, FPNG_CRC32_INIT);
-			for (i = 0; i < 4; ++i, c <<= 8)
-				((uint8_t*)(pnghdr + 29))[i] = (uint8_t)(c >> 24);
+		// The IDAT CRC-32 covers the chunk type and the zlib stream
+		uint32_t idat_crc32 = fpng_crc32("IDAT", 4, FPNG_CRC32_INIT);
 
-			memcpy(out_buf.data(), pnghdr, PNG_HEADER_SIZE);
+		for (uint32_t strip_index = 0; strip_index < num_strips; strip_index++)
+		{
+			const strip& st = m_strips[strip_index];
+
+			memcpy(m_out.data() + out_ofs, st.m_defl.data(), st.m_defl_size);
+			out_ofs += st.m_defl_size;
+
+			adler32 = fpng_adler32_combine(adler32, st.m_adler32, (uint64_t)(bpl + 1) * st.m_num_rows);
+			idat_crc32 = fpng_crc32_combine(idat_crc32, st.m_defl_crc32, st.m_defl_size);
 		}
 
+		// Write zlib adler32
+		for (uint32_t i = 0; i < 4; i++, adler32 <<= 8)
+			m_out[out_ofs++] = (uint8_t)(adler32 >> 24);
+		idat_crc32 = fpng_crc32(m_out.data() + out_ofs - 4, 4, idat_crc32);
+
+		write_png_header(m_out.data(), w, h, num_chans, (uint32_t)zlib_size);
+
 		// Write IDAT chunk's CRC32 and a 0 length IEND chunk
-		vector_append(out_buf, "\0\0\0\0\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82", 16); // IDAT CRC32, followed by the IEND chunk
+		memcpy(m_out.data() + out_ofs, "\0\0\0\0\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82", 16);
+		for (uint32_t i = 0; i < 4; i++, idat_crc32 <<= 8)
+			m_out[out_ofs + i] = (uint8_t)(idat_crc32 >> 24);
+
+		m_png_size = out_ofs + 16;
+		return true;
+	}
+
+	// Filtered bytes compressed together by fpng_stream_encoder, large enough that the Huffman table and IDAT chunk of each band don't matter
+	const uint32_t STREAM_BAND_BYTES = 1 << 20;
+
+	static bool write_to_fd(const void* pData, size_t size, void* pUser)
+	{
+		const int fd = (int)(intptr_t)pUser;
+		const uint8_t* pBytes = static_cast<const uint8_t*>(pData);
+
+		while (size)
+		{
+#ifdef _WIN32
+			const int n = _write(fd, pBytes, (unsigned int)minimum<size_t>(size, INT32_MAX));
+#else
+			const ssize_t n = ::write(fd, pBytes, minimum<size_t>(size, INT32_MAX));
+#endif
+			if (n <= 0)
+				return false;
+
+			pBytes += n;
+			size -= (size_t)n;
+		}
+
+		return true;
+	}
+
+	bool fpng_stream_encoder::begin(uint32_t w, uint32_t h, uint32_t num_chans, int fd, uint32_t flags)
+	{
+		return begin(w, h, num_chans, write_to_fd, (void*)(intptr_t)fd, flags);
+	}
+
+	bool fpng_stream_encoder::begin(uint32_t w, uint32_t h, uint32_t num_chans, write_func pWrite, void* pUser, uint32_t flags)
+	{
+		m_active = false;
+
+		if (!endian_check())
+		{
+			assert(0);
+			return false;
+		}
+
+		if ((w < 1) || (h < 1) || (w > FPNG_MAX_SUPPORTED_DIM) || (h > INT32_MAX) || ((num_chans != 3) && (num_chans != 4)) || (!pWrite))
+		{
+			assert(0);
+			return false;
+		}
+
+		m_flags = flags;
+		m_pWrite = pWrite;
+		m_pUser = pUser;
+		m_w = w;
+		m_h = h;
+		m_num_chans = num_chans;
+		m_bpl = w * num_chans;
+		m_band_rows = minimum<uint32_t>(h, maximum<uint32_t>(1, STREAM_BAND_BYTES / (m_bpl + 1)));
+		m_rows_added = 0;
+		m_band_rows_filtered = 0;
+		m_adler32 = FPNG_ADLER32_INIT;
+		m_tile_x = 0;
+		m_tile_h = 0;
+		m_bytes_written = 0;
+
+		m_prev_row.resize(m_bpl);
+		// Room for the one past the end pixel reads of the deflaters
+		m_filtered.resize((size_t)(m_bpl + 1) * m_band_rows + 7);
+
+		// PNG signature, IHDR and fdEC chunk, without the IDAT chunk the header ends with
+		uint8_t hdr[PNG_HEADER_SIZE];
+		write_png_header(hdr, w, h, num_chans, 0);
+
+		m_active = true;
+		return write(hdr, PNG_HEADER_SIZE - 8);
+	}
+
+	bool fpng_stream_encoder::add_rows(const void* pRows, uint32_t num_rows, int64_t row_pitch)
+	{
+		if ((!m_active) || (num_rows > m_h - m_rows_added) || (m_tile_x) || ((uint64_t)(row_pitch < 0 ? -row_pitch : row_pitch) < m_bpl))
+		{
+			assert(0);
+			return false;
+		}
+
+		for (uint32_t y = 0; y < num_rows; ++y)
+		{
+			// Within a call the previous row is still in the caller's buffer, only the last one is kept for the next call
+			const uint8_t* pSrc = (const uint8_t*)pRows + (int64_t)y * row_pitch;
+			const uint8_t* pPrev_src = y ? (pSrc - row_pitch) : m_prev_row.data();
+
+			filter_scanline(m_flags, m_w, 1, m_num_chans, m_bpl, pSrc, m_rows_added ? pPrev_src : nullptr, &m_filtered[(size_t)(m_bpl + 1) * m_band_rows_filtered]);
+
+			m_rows_added++;
+			m_band_rows_filtered++;
+
+			if ((m_band_rows_filtered == m_band_rows) || (m_rows_added == m_h))
+			{
+				if (!flush_band())
+					return false;
+			}
+		}
+
+		if (num_rows)
+			memcpy(m_prev_row.data(), (const uint8_t*)pRows + (int64_t)(num_rows - 1) * row_pitch, m_bpl);
 
-		// Compute IDAT crc32
-		uint32_t c = (uint32_t)fpng_crc32(out_buf.data() + PNG_HEADER_SIZE - 4, idat_len + 4, FPNG_CRC32_INIT);
-		
-		for (i = 0; i < 4; ++i, c <<= 8)
-			(out_buf.data() + out_buf.size() - 16)[i] = (uint8_t)(c >> 24);
-				
 		return true;
 	}
 
+	bool fpng_stream_encoder::add_tile(uint32_t x, const void* pTile, uint32_t tile_w, uint32_t tile_h, int64_t row_pitch)
+	{
+		if ((!m_active) || (x != m_tile_x) || (!tile_w) || (tile_w > m_w - x) || (!tile_h) || (tile_h > m_h - m_rows_added) || ((x) && (tile_h != m_tile_h)) ||
+			((uint64_t)(row_pitch < 0 ? -row_pitch : row_pitch) < (uint64_t)tile_w * m_num_chans))
+		{
+			assert(0);
+			return false;
+		}
+
+		// A tile spanning the whole width is a band of rows
+		if (tile_w == m_w)
+			return add_rows(pTile, tile_h, row_pitch);
+
+		if (m_tile_rows.size() < (size_t)m_bpl * tile_h)
+			m_tile_rows.resize((size_t)m_bpl * tile_h);
+
+		for (uint32_t y = 0; y < tile_h; ++y)
+			memcpy(&m_tile_rows[(size_t)m_bpl * y + (size_t)x * m_num_chans], (const uint8_t*)pTile + (int64_t)y * row_pitch, (size_t)tile_w * m_num_chans);
+
+		m_tile_h = tile_h;
+		m_tile_x += tile_w;
+		if (m_tile_x < m_w)
+			return true;
+
+		m_tile_x = 0;
+		return add_rows(m_tile_rows.data(), tile_h, m_bpl);
+	}
+
+	bool fpng_stream_encoder::end()
+	{
+		if ((!m_active) || (m_rows_added != m_h))
+		{
+			assert(0);
+			m_active = false;
+			return false;
+		}
+
+		m_active = false;
+
+		// 0 length IEND chunk
+		return write("\0\0\0\0\x49\x45\x4e\x44\xae\x42\x60\x82", 12);
+	}
+
+	bool fpng_stream_encoder::write(const void* pData, size_t size)
+	{
+		if (!m_pWrite(pData, size, m_pUser))
+		{
+			m_active = false;
+			return false;
+		}
+
+		m_bytes_written += size;
+		return true;
+	}
+
+	bool fpng_stream_encoder::flush_band()
+	{
+		const uint32_t filtered_size = (m_bpl + 1) * m_band_rows_filtered;
+		memset(&m_filtered[filtered_size], 0, 7);
+
+		const bool first_band = (m_rows_added == m_band_rows_filtered), last_band = (m_rows_added == m_h);
+
+		m_adler32 = fpng_adler32(m_filtered.data(), filtered_size, m_adler32);
+
+		uint32_t strip_flags = 0;
+		if (first_band)
+			strip_flags |= DEFL_STRIP_ZLIB_HEADER;
+		if (last_band)
+			strip_flags |= DEFL_STRIP_FINAL_BLOCK;
+
+		// Same bounds as the strips of the parallel encoder and the raw blocks of the serial encoder, plus the chunk length, type and CRC-32 and the Adler-32
+		const uint32_t defl_buf_size = (filtered_size + PNG_HEADER_SIZE + 16 + 7) & ~7;
+		const uint32_t raw_buf_size = 2 + filtered_size + ((filtered_size + 65534) / 65535) * 5;
+		if (m_idat.size() < 8 + (size_t)maximum(defl_buf_size, raw_buf_size) + 8)
+			m_idat.resize(8 + (size_t)maximum(defl_buf_size, raw_buf_size) + 8);
+
+		uint8_t* pData = m_idat.data() + 8;
+
+		uint32_t data_len;
+		if (m_num_chans == 3)
+			data_len = pixel_deflate_dyn_3_rle_one_pass(m_filtered.data(), m_w, m_band_rows_filtered, pData, defl_buf_size, strip_flags);
+		else
+			data_len = pixel_deflate_dyn_4_rle_one_pass(m_filtered.data(), m_w, m_band_rows_filtered, pData, defl_buf_size, get_dyn_huff_4_table(m_flags), strip_flags);
+
+		// The band didn't compress, store it. Stored blocks are byte aligned like the end of the compressed bands, so the stream continues either way.
+		if (!data_len)
+			data_len = write_raw_block(m_filtered.data(), filtered_size, pData, raw_buf_size, strip_flags);
+
+		if (!data_len)
+		{
+			// Somehow we miscomputed the size of the output buffer.
+			assert(0);
+			m_active = false;
+			return false;
+		}
+
+		m_band_rows_filtered = 0;
+
+		// Write zlib adler32 at the end of the last chunk
+		if (last_band)
+		{
+			for (uint32_t i = 0; i < 4; i++, m_adler32 <<= 8)
+				pData[data_len++] = (uint8_t)(m_adler32 >> 24);
+		}
+
+		for (uint32_t i = 0; i < 4; i++)
+			m_idat[i] = (uint8_t)(data_len >> (24 - i * 8));
+		memcpy(m_idat.data() + 4, "IDAT", 4);
+
+		uint32_t c = fpng_crc32(m_idat.data() + 4, data_len + 4, FPNG_CRC32_INIT);
+		for (uint32_t i = 0; i < 4; i++, c <<= 8)
+			pData[data_len + i] = (uint8_t)(c >> 24);
+
+		return write(m_idat.data(), 8 + (size_t)data_len + 4);
+	}
+
 #ifndef FPNG_NO_STDIO
 	bool fpng_encode_image_to_file(const char* pFilename, const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, uint32_t flags)
 	{
@@ -2104,10 +3362,131 @@ do_literals:
 		return true;
 	}
 		
-	static bool fpng_pixel_zlib_raw_decompress(
-		const uint8_t* pSrc, uint32_t src_len, uint32_t zlib_len,
-		uint8_t* pDst, uint32_t w, uint32_t h,
-		uint32_t src_chans, uint32_t dst_chans)
+	// Called after the EOB of a non-final block at a scanline boundary, which fpng_encode_image_to_memory_parallel() and fpng_stream_encoder write
+	// between strips: skips the empty stored block that byte aligns the stream and prepares the dynamic block of the next strip, or sets stored
+	// if the next strip was stored because it didn't compress.
+	static bool next_strip_block(
+		const uint8_t* pSrc, uint32_t src_len, uint32_t& src_ofs,
+		uint32_t& bit_buf_size, uint64_t& bit_buf,
+		uint32_t* pLit_table, uint32_t num_chans, uint32_t& bfinal, bool& stored)
+	{
+		if (bfinal)
+			return false;
+
+		uint32_t stored_hdr;
+		GET_BITS(stored_hdr, 3);
+		if (stored_hdr != 0)
+			return false;
+
+		SKIP_BITS(bit_buf_size & 7);
+
+		uint32_t len, nlen;
+		GET_BITS(len, 16);
+		GET_BITS(nlen, 16);
+		if ((len != 0) || (nlen != 0xFFFF))
+			return false;
+
+		// A band the stream encoder stored follows, hand over at its first byte, which the bit buffer has read ahead
+		stored = (pSrc[src_ofs - (bit_buf_size >> 3)] & 6) == 0;
+		if (stored)
+		{
+			src_ofs -= (bit_buf_size >> 3);
+			bit_buf = 0;
+			bit_buf_size = 0;
+			return true;
+		}
+
+		uint32_t btype;
+		GET_BITS(bfinal, 1);
+		GET_BITS(btype, 2);
+		if (btype != 2)
+			return false;
+
+		return prepare_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, pLit_table, num_chans);
+	}
+
+	// Reverses a Sub, Average or Paeth filter in place on a decoded row that still holds the filtered bytes. Pixels are stride bytes apart,
+	// of which the first num_chans were filtered, so the alpha added to an RGB image decoded to RGBA is left alone.
+	template<uint32_t FILTER>
+	static void unfilter_row(uint8_t* pCur, const uint8_t* pPrev, uint32_t bpl, uint32_t stride, uint32_t num_chans)
+	{
+		for (uint32_t ofs = 0; ofs < bpl; ofs += stride)
+		{
+			for (uint32_t i = ofs; i < ofs + num_chans; i++)
+			{
+				const int a = ofs ? pCur[i - stride] : 0, b = pPrev ? pPrev[i] : 0, c = (ofs && pPrev) ? pPrev[i - stride] : 0;
+
+				int pred;
+				switch (FILTER)
+				{
+				case FILTER_SUB: pred = a; break;
+				case FILTER_AVERAGE: pred = (a + b) >> 1; break;
+				default: pred = paeth_predict(a, b, c); break;
+				}
+
+				pCur[i] = (uint8_t)(pCur[i] + pred);
+			}
+		}
+	}
+
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
+	// RGBA rows, with the 4 channels of a pixel widened to 16 bits in one register
+	template<uint32_t FILTER>
+	static void unfilter_row_4_sse41(uint8_t* pCur, const uint8_t* pPrev, uint32_t bpl)
+	{
+		const __m128i zero = _mm_setzero_si128(), byte_mask = _mm_set1_epi16(0xFF);
+		__m128i a = zero, c = zero;
+
+		for (uint32_t ofs = 0; ofs < bpl; ofs += 4)
+		{
+			const __m128i x = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)READ_LE32(pCur + ofs)), zero);
+			const __m128i b = pPrev ? _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)READ_LE32(pPrev + ofs)), zero) : zero;
+
+			__m128i pred;
+			switch (FILTER)
+			{
+			case FILTER_SUB: pred = a; break;
+			case FILTER_AVERAGE: pred = _mm_srli_epi16(_mm_add_epi16(a, b), 1); break;
+			default: pred = paeth_predict_sse41(a, b, c); break;
+			}
+
+			a = _mm_and_si128(_mm_add_epi16(x, pred), byte_mask);
+			WRITE_LE32(pCur + ofs, (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(a, a)));
+			c = b;
+		}
+	}
+#endif
+
+	static void unfilter_row(uint32_t filter, uint8_t* pCur, const uint8_t* pPrev, uint32_t bpl, uint32_t stride, uint32_t num_chans)
+	{
+#if FPNG_X86_OR_X64_CPU && !FPNG_NO_SSE
+		if ((stride == 4) && (num_chans == 4) && (g_cpu_info.can_use_sse41()))
+		{
+			switch (filter)
+			{
+			case FILTER_SUB: unfilter_row_4_sse41<FILTER_SUB>(pCur, pPrev, bpl); return;
+			case FILTER_AVERAGE: unfilter_row_4_sse41<FILTER_AVERAGE>(pCur, pPrev, bpl); return;
+			case FILTER_PAETH: unfilter_row_4_sse41<FILTER_PAETH>(pCur, pPrev, bpl); return;
+			default: assert(0); return;
+			}
+		}
+#endif
+		switch (filter)
+		{
+		case FILTER_SUB: unfilter_row<FILTER_SUB>(pCur, pPrev, bpl, stride, num_chans); return;
+		case FILTER_AVERAGE: unfilter_row<FILTER_AVERAGE>(pCur, pPrev, bpl, stride, num_chans); return;
+		case FILTER_PAETH: unfilter_row<FILTER_PAETH>(pCur, pPrev, bpl, stride, num_chans); return;
+		default: assert(0); return;
+		}
+	}
+
+	// Decodes the rows of consecutive stored blocks, starting with the block header at src_ofs and row y. Whole images that didn't compress
+	// are stored, as are the bands of the stream encoder that didn't, with the filters they were compressed with. Stops after the final block,
+	// leaving bfinal set, or at the header of the first block that isn't stored, which must start a row.
+	static bool decode_stored_rows(
+		const uint8_t* pSrc, uint32_t src_len, uint32_t& src_ofs,
+		uint8_t* pDst, uint32_t w, uint32_t h, uint32_t& y,
+		uint32_t src_chans, uint32_t dst_chans, uint32_t& bfinal)
 	{
 		assert((src_chans == 3) || (src_chans == 4));
 		assert((dst_chans == 3) || (dst_chans == 4));
@@ -2116,21 +3495,22 @@ do_literals:
 		const uint32_t dst_bpl = w * dst_chans;
 		const uint32_t dst_len = dst_bpl * h;
 
-		uint32_t src_ofs = 2;
-		uint32_t dst_ofs = 0;
+		uint32_t dst_ofs = y * dst_bpl;
 		uint32_t raster_ofs = 0;
 		uint32_t comp_ofs = 0;
+		uint32_t filter = FILTER_NONE;
 
-		for (; ; )
+		bfinal = 0;
+		while (!bfinal)
 		{
 			if ((src_ofs + 1) > src_len)
 				return false;
 
-			const bool bfinal = (pSrc[src_ofs] & 1) != 0;
 			const uint32_t btype = (pSrc[src_ofs] >> 1) & 3;
 			if (btype != 0)
-				return false;
+				break;
 
+			bfinal = pSrc[src_ofs] & 1;
 			src_ofs++;
 
 			if ((src_ofs + 4) > src_len)
@@ -2153,10 +3533,11 @@ do_literals:
 
 				if (!raster_ofs)
 				{
-					// Check filter type
-					if (c != 0)
+					// Check filter type, the filter is reversed once the row is complete
+					if (c > FILTER_PAETH)
 						return false;
-					
+
+					filter = c;
 					assert(!comp_ofs);
 				}
 				else
@@ -2187,23 +3568,58 @@ do_literals:
 				{
 					assert(!comp_ofs);
 					raster_ofs = 0;
+
+					if (filter != FILTER_NONE)
+					{
+						uint8_t* pCur_scanline = pDst + dst_ofs - dst_bpl;
+						const uint8_t* pPrev_scanline = (dst_ofs > dst_bpl) ? (pCur_scanline - dst_bpl) : nullptr;
+						const uint32_t num_chans = minimum(src_chans, dst_chans);
+
+						if (filter != FILTER_UP)
+							unfilter_row(filter, pCur_scanline, pPrev_scanline, dst_bpl, dst_chans, num_chans);
+						else if (pPrev_scanline)
+						{
+							for (uint32_t ofs = 0; ofs < dst_bpl; ofs += dst_chans)
+								for (uint32_t j = ofs; j < ofs + num_chans; j++)
+									pCur_scanline[j] = (uint8_t)(pCur_scanline[j] + pPrev_scanline[j]);
+						}
+					}
 				}
 			}
 
 			src_ofs += len;
-
-			if (bfinal)
-				break;
 		}
 
-		if (comp_ofs != 0)
+		// The blocks must end with a complete row
+		if ((comp_ofs != 0) || (raster_ofs != 0))
 			return false;
 
-		// Check for zlib adler32
-		if ((src_ofs + 4) != zlib_len)
+		y = dst_ofs / dst_bpl;
+		return true;
+	}
+
+	// Starts the dynamic block at the byte aligned src_ofs, which follows the zlib header or stored blocks
+	static bool start_dynamic_block(
+		const uint8_t* pSrc, uint32_t src_len, uint32_t& src_ofs,
+		uint32_t& bit_buf_size, uint64_t& bit_buf,
+		uint32_t* pLit_table, uint32_t num_chans, uint32_t& bfinal)
+	{
+		if ((src_ofs + 4) > src_len)
+			return false;
+		bit_buf = READ_LE32(pSrc + src_ofs);
+		src_ofs += 4;
+
+		bit_buf_size = 32;
+
+		uint32_t btype;
+		GET_BITS(bfinal, 1);
+		GET_BITS(btype, 2);
+
+		// Must be type=2 (dynamic)
+		if (btype != 2)
 			return false;
 
-		return (dst_ofs == dst_len);
+		return prepare_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, pLit_table, num_chans);
 	}
 	
 	template<uint32_t dst_comps>
@@ -2224,46 +3640,72 @@ do_literals:
 			return false;
 
 		uint32_t src_ofs = 2;
-		
+		uint32_t y = 0;
+		uint32_t bfinal = 0;
+
+		// Images that didn't compress are stored as a whole, the stream encoder stores single bands
 		if ((pSrc[src_ofs] & 6) == 0)
-			return fpng_pixel_zlib_raw_decompress(pSrc, src_len, zlib_len, pDst, w, h, 3, dst_comps);
-		
-		if ((src_ofs + 4) > src_len)
-			return false;
-		uint64_t bit_buf = READ_LE32(pSrc + src_ofs);
-		src_ofs += 4;
+		{
+			if (!decode_stored_rows(pSrc, src_len, src_ofs, pDst, w, h, y, 3, dst_comps, bfinal))
+				return false;
 
-		uint32_t bit_buf_size = 32;
+			// We should be at the very end, followed by the zlib adler32
+			if (bfinal)
+				return (y == h) && ((src_ofs + 4) == zlib_len);
+		}
 
-		uint32_t bfinal, btype;
-		GET_BITS(bfinal, 1);
-		GET_BITS(btype, 2);
+		uint64_t bit_buf = 0;
+		uint32_t bit_buf_size = 0;
 
-		// Must be the final block or it's not valid, and type=2 (dynamic)
-		if ((bfinal != 1) || (btype != 2))
-			return false;
-		
 		uint32_t lit_table[FPNG_DECODER_TABLE_SIZE];
-		if (!prepare_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 3))
+		if (!start_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 3, bfinal))
 			return false;
 
-		const uint8_t* pPrev_scanline = nullptr;
-		uint8_t* pCur_scanline = pDst;
+		const uint8_t* pPrev_scanline = y ? (pDst + (y - 1) * dst_bpl) : nullptr;
+		uint8_t* pCur_scanline = pDst + y * dst_bpl;
 
-		for (uint32_t y = 0; y < h; y++)
+		for ( ; y < h; y++)
 		{
 			// At start of PNG scanline, so read the filter literal
-			assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
-			uint32_t filter = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
-			uint32_t filter_len = (filter >> 9) & 15;
-			if (!filter_len)
-				return false;
-			SKIP_BITS(filter_len);
-			filter &= 511;
+			uint32_t filter;
+			for ( ; ; )
+			{
+				assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
+				filter = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
+				uint32_t filter_len = (filter >> 9) & 15;
+				if (!filter_len)
+					return false;
+				SKIP_BITS(filter_len);
+				filter &= 511;
+
+				// EOB instead of a filter ends the block of a strip
+				if (filter != 256)
+					break;
+				bool stored;
+				if (!next_strip_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 3, bfinal, stored))
+					return false;
+				if (!stored)
+					continue;
 
-			uint32_t expected_filter = (y ? 2 : 0);
-			if (filter != expected_filter)
+				// Copy the rows of the stored strip, then continue with the dynamic block after it unless the stream ends
+				if (!decode_stored_rows(pSrc, src_len, src_ofs, pDst, w, h, y, 3, dst_comps, bfinal))
+					return false;
+				if (bfinal)
+					return (y == h) && ((src_ofs + 4) == zlib_len);
+				if (y == h)
+					return false;
+
+				if (!start_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 3, bfinal))
+					return false;
+
+				pPrev_scanline = y ? (pDst + (y - 1) * dst_bpl) : nullptr;
+				pCur_scanline = pDst + y * dst_bpl;
+			}
+
+			// Up is reversed while decoding, the other filters afterwards on the decoded differences
+			if (filter > FILTER_PAETH)
 				return false;
+			const uint8_t* pUp_scanline = (filter == FILTER_UP) ? pPrev_scanline : nullptr;
 
 			uint32_t x_ofs = 0;
 			uint8_t prev_delta_r = 0, prev_delta_g = 0, prev_delta_b = 0;
@@ -2314,20 +3756,20 @@ do_literals:
 						if (x_ofs_end > dst_bpl)
 							return false;
 
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
 							if ((prev_delta_r | prev_delta_g | prev_delta_b) == 0)
 							{
-								memcpy(pCur_scanline + x_ofs, pPrev_scanline + x_ofs, x_ofs_end - x_ofs);
+								memcpy(pCur_scanline + x_ofs, pUp_scanline + x_ofs, x_ofs_end - x_ofs);
 								x_ofs = x_ofs_end;
 							}
 							else
 							{
 								do
 								{
-									pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + prev_delta_r);
-									pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + prev_delta_g);
-									pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + prev_delta_b);
+									pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + prev_delta_r);
+									pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + prev_delta_g);
+									pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + prev_delta_b);
 									pCur_scanline[x_ofs + 3] = 0xFF;
 									x_ofs += 4;
 								} while (x_ofs < x_ofs_end);
@@ -2357,20 +3799,20 @@ do_literals:
 						if (x_ofs_end > dst_bpl)
 							return false;
 
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
 							if ((prev_delta_r | prev_delta_g | prev_delta_b) == 0)
 							{
-								memcpy(pCur_scanline + x_ofs, pPrev_scanline + x_ofs, run_len);
+								memcpy(pCur_scanline + x_ofs, pUp_scanline + x_ofs, run_len);
 								x_ofs = x_ofs_end;
 							}
 							else
 							{
 								do
 								{
-									pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + prev_delta_r);
-									pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + prev_delta_g);
-									pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + prev_delta_b);
+									pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + prev_delta_r);
+									pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + prev_delta_g);
+									pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + prev_delta_b);
 									x_ofs += 3;
 								} while (x_ofs < x_ofs_end);
 							}
@@ -2434,11 +3876,11 @@ do_literals:
 
 					if (dst_comps == 4)
 					{
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
-							pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + lit0);
-							pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + lit1);
-							pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + lit2);
+							pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + lit0);
+							pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + lit1);
+							pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + lit2);
 							pCur_scanline[x_ofs + 3] = 0xFF;
 						}
 						else
@@ -2452,11 +3894,11 @@ do_literals:
 					}
 					else
 					{
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
-							pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + lit0);
-							pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + lit1);
-							pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + lit2);
+							pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + lit0);
+							pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + lit1);
+							pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + lit2);
 						}
 						else
 						{
@@ -2507,11 +3949,11 @@ do_literals:
 					
 							if (dst_comps == 4)
 							{
-								if (pPrev_scanline)
+								if (pUp_scanline)
 								{
-									pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + lit0);
-									pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + lit1);
-									pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + lit2);
+									pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + lit0);
+									pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + lit1);
+									pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + lit2);
 									pCur_scanline[x_ofs + 3] = 0xFF;
 								}
 								else
@@ -2525,11 +3967,11 @@ do_literals:
 							}
 							else
 							{
-								if (pPrev_scanline)
+								if (pUp_scanline)
 								{
-									pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + lit0);
-									pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + lit1);
-									pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + lit2);
+									pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + lit0);
+									pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + lit1);
+									pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + lit2);
 								}
 								else
 								{
@@ -2551,12 +3993,18 @@ do_literals:
 
 			} while (x_ofs < dst_bpl);
 
+			if ((filter != FILTER_NONE) && (filter != FILTER_UP))
+				unfilter_row(filter, pCur_scanline, pPrev_scanline, dst_bpl, dst_comps, minimum<uint32_t>(3, dst_comps));
+
 			pPrev_scanline = pCur_scanline;
 			pCur_scanline += dst_bpl;
 
 		} // y
 
-		// The last symbol should be EOB
+		// The last symbol should be EOB of the final block
+		if (bfinal != 1)
+			return false;
+
 		assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
 		uint32_t lit0 = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
 		uint32_t lit0_len = (lit0 >> 9) & 15;
@@ -2602,46 +4050,72 @@ do_literals:
 			return false;
 
 		uint32_t src_ofs = 2;
+		uint32_t y = 0;
+		uint32_t bfinal = 0;
 
+		// Images that didn't compress are stored as a whole, the stream encoder stores single bands
 		if ((pSrc[src_ofs] & 6) == 0)
-			return fpng_pixel_zlib_raw_decompress(pSrc, src_len, zlib_len, pDst, w, h, 4, dst_comps);
-
-		if ((src_ofs + 4) > src_len)
-			return false;
-		uint64_t bit_buf = READ_LE32(pSrc + src_ofs);
-		src_ofs += 4;
-
-		uint32_t bit_buf_size = 32;
+		{
+			if (!decode_stored_rows(pSrc, src_len, src_ofs, pDst, w, h, y, 4, dst_comps, bfinal))
+				return false;
 
-		uint32_t bfinal, btype;
-		GET_BITS(bfinal, 1);
-		GET_BITS(btype, 2);
+			// We should be at the very end, followed by the zlib adler32
+			if (bfinal)
+				return (y == h) && ((src_ofs + 4) == zlib_len);
+		}
 
-		// Must be the final block or it's not valid, and type=2 (dynamic)
-		if ((bfinal != 1) || (btype != 2))
-			return false;
+		uint64_t bit_buf = 0;
+		uint32_t bit_buf_size = 0;
 
 		uint32_t lit_table[FPNG_DECODER_TABLE_SIZE];
-		if (!prepare_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 4))
+		if (!start_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 4, bfinal))
 			return false;
 
-		const uint8_t* pPrev_scanline = nullptr;
-		uint8_t* pCur_scanline = pDst;
+		const uint8_t* pPrev_scanline = y ? (pDst + (y - 1) * dst_bpl) : nullptr;
+		uint8_t* pCur_scanline = pDst + y * dst_bpl;
 
-		for (uint32_t y = 0; y < h; y++)
+		for ( ; y < h; y++)
 		{
 			// At start of PNG scanline, so read the filter literal
-			assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
-			uint32_t filter = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
-			uint32_t filter_len = (filter >> 9) & 15;
-			if (!filter_len)
-				return false;
-			SKIP_BITS(filter_len);
-			filter &= 511;
+			uint32_t filter;
+			for ( ; ; )
+			{
+				assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
+				filter = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
+				uint32_t filter_len = (filter >> 9) & 15;
+				if (!filter_len)
+					return false;
+				SKIP_BITS(filter_len);
+				filter &= 511;
+
+				// EOB instead of a filter ends the block of a strip
+				if (filter != 256)
+					break;
+				bool stored;
+				if (!next_strip_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 4, bfinal, stored))
+					return false;
+				if (!stored)
+					continue;
+
+				// Copy the rows of the stored strip, then continue with the dynamic block after it unless the stream ends
+				if (!decode_stored_rows(pSrc, src_len, src_ofs, pDst, w, h, y, 4, dst_comps, bfinal))
+					return false;
+				if (bfinal)
+					return (y == h) && ((src_ofs + 4) == zlib_len);
+				if (y == h)
+					return false;
+
+				if (!start_dynamic_block(pSrc, src_len, src_ofs, bit_buf_size, bit_buf, lit_table, 4, bfinal))
+					return false;
 
-			uint32_t expected_filter = (y ? 2 : 0);
-			if (filter != expected_filter)
+				pPrev_scanline = y ? (pDst + (y - 1) * dst_bpl) : nullptr;
+				pCur_scanline = pDst + y * dst_bpl;
+			}
+
+			// Up is reversed while decoding, the other filters afterwards on the decoded differences
+			if (filter > FILTER_PAETH)
 				return false;
+			const uint8_t* pUp_scanline = (filter == FILTER_UP) ? pPrev_scanline : nullptr;
 
 			uint32_t x_ofs = 0;
 			uint8_t prev_delta_r = 0, prev_delta_g = 0, prev_delta_b = 0, prev_delta_a = 0;
@@ -2690,20 +4164,20 @@ do_literals:
 						if (x_ofs_end > dst_bpl)
 							return false;
 
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
 							if ((prev_delta_r | prev_delta_g | prev_delta_b | prev_delta_a) == 0)
 							{
-								memcpy(pCur_scanline + x_ofs, pPrev_scanline + x_ofs, run_len3);
+								memcpy(pCur_scanline + x_ofs, pUp_scanline + x_ofs, run_len3);
 								x_ofs = x_ofs_end;
 							}
 							else
 							{
 								do
 								{
-									pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + prev_delta_r);
-									pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + prev_delta_g);
-									pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + prev_delta_b);
+									pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + prev_delta_r);
+									pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + prev_delta_g);
+									pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + prev_delta_b);
 									x_ofs += 3;
 								} while (x_ofs < x_ofs_end);
 							}
@@ -2727,21 +4201,21 @@ do_literals:
 						if (x_ofs_end > dst_bpl)
 							return false;
 
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
 							if ((prev_delta_r | prev_delta_g | prev_delta_b | prev_delta_a) == 0)
 							{
-								memcpy(pCur_scanline + x_ofs, pPrev_scanline + x_ofs, run_len);
+								memcpy(pCur_scanline + x_ofs, pUp_scanline + x_ofs, run_len);
 								x_ofs = x_ofs_end;
 							}
 							else
 							{
 								do
 								{
-									pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + prev_delta_r);
-									pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + prev_delta_g);
-									pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + prev_delta_b);
-									pCur_scanline[x_ofs + 3] = (uint8_t)(pPrev_scanline[x_ofs + 3] + prev_delta_a);
+									pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + prev_delta_r);
+									pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + prev_delta_g);
+									pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + prev_delta_b);
+									pCur_scanline[x_ofs + 3] = (uint8_t)(pUp_scanline[x_ofs + 3] + prev_delta_a);
 									x_ofs += 4;
 								} while (x_ofs < x_ofs_end);
 							}
@@ -2825,11 +4299,11 @@ do_literals:
 
 					if (dst_comps == 3)
 					{
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
-							pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + lit0);
-							pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + lit1);
-							pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + lit2);
+							pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + lit0);
+							pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + lit1);
+							pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + lit2);
 						}
 						else
 						{
@@ -2842,12 +4316,12 @@ do_literals:
 					}
 					else
 					{
-						if (pPrev_scanline)
+						if (pUp_scanline)
 						{
-							pCur_scanline[x_ofs] = (uint8_t)(pPrev_scanline[x_ofs] + lit0);
-							pCur_scanline[x_ofs + 1] = (uint8_t)(pPrev_scanline[x_ofs + 1] + lit1);
-							pCur_scanline[x_ofs + 2] = (uint8_t)(pPrev_scanline[x_ofs + 2] + lit2);
-							pCur_scanline[x_ofs + 3] = (uint8_t)(pPrev_scanline[x_ofs + 3] + lit3);
+							pCur_scanline[x_ofs] = (uint8_t)(pUp_scanline[x_ofs] + lit0);
+							pCur_scanline[x_ofs + 1] = (uint8_t)(pUp_scanline[x_ofs + 1] + lit1);
+							pCur_scanline[x_ofs + 2] = (uint8_t)(pUp_scanline[x_ofs + 2] + lit2);
+							pCur_scanline[x_ofs + 3] = (uint8_t)(pUp_scanline[x_ofs + 3] + lit3);
 						}
 						else
 						{
@@ -2868,11 +4342,17 @@ do_literals:
 
 			} while (x_ofs < dst_bpl);
 
+			if ((filter != FILTER_NONE) && (filter != FILTER_UP))
+				unfilter_row(filter, pCur_scanline, pPrev_scanline, dst_bpl, dst_comps, minimum<uint32_t>(4, dst_comps));
+
 			pPrev_scanline = pCur_scanline;
 			pCur_scanline += dst_bpl;
 		} // y
 
-		// The last symbol should be EOB
+		// The last symbol should be EOB of the final block
+		if (bfinal != 1)
+			return false;
+
 		assert(bit_buf_size >= FPNG_DECODER_TABLE_BITS);
 		uint32_t lit0 = lit_table[bit_buf & (FPNG_DECODER_TABLE_SIZE - 1)];
 		uint32_t lit0_len = (lit0 >> 9) & 15;
@@ -2927,7 +4407,7 @@ do_literals:
 	};
 #pragma pack(pop)
 
-	static int fpng_get_info_internal(const void* pImage, uint32_t image_size, uint32_t& width, uint32_t& height, uint32_t& channels_in_file, uint32_t &idat_ofs, uint32_t &idat_len)
+	static int fpng_get_info_internal(const void* pImage, uint32_t image_size, uint32_t& width, uint32_t& height, uint32_t& channels_in_file, uint32_t &idat_ofs, uint32_t &idat_len, uint32_t &num_idats)
 	{
 		static const uint8_t s_png_sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
 
@@ -2981,8 +4461,9 @@ do_literals:
 		if (!channels_in_file)
 			return FPNG_DECODE_NOT_FPNG;
 
-		// Scan all the chunks. Look for one IDAT, IEND, and our custom fdEC chunk that indicates the file was compressed by us. Skip any ancillary chunks.
-		bool found_fdec_chunk = false;
+		// Scan all the chunks. Look for the IDAT chunks, IEND, and our custom fdEC chunk that indicates the file was compressed by us. Skip any ancillary chunks.
+		bool found_fdec_chunk = false, prev_chunk_was_idat = false;
+		num_idats = 0;
 		
 		for (; ; )
 		{
@@ -3028,16 +4509,24 @@ do_literals:
 				break;
 			else if (is_idat)
 			{
-				// If there were multiple IDAT's, or we didn't find the fdEC chunk, then it's not FPNG.
-				if ((idat_ofs) || (!found_fdec_chunk))
+				// If we didn't find the fdEC chunk, then it's not FPNG.
+				if (!found_fdec_chunk)
 					return FPNG_DECODE_NOT_FPNG;
 
-				idat_ofs = (uint32_t)src_ofs;
-				idat_len = chunk_len;
+				if (!idat_ofs)
+				{
+					idat_ofs = (uint32_t)src_ofs;
+					idat_len = chunk_len;
+				}
+				else
+				{
+					// The stream encoder writes consecutive IDAT chunks, which hold one zlib stream
+					if (!prev_chunk_was_idat)
+						return FPNG_DECODE_NOT_FPNG;
 
-				// Sanity check the IDAT chunk length
-				if (idat_len < 7)
-					return FPNG_DECODE_FAILED_INVALID_IDAT;
+					idat_len += chunk_len;
+				}
+				num_idats++;
 			}
 			else if (strcmp(chunk_type, "fdEC") == 0)
 			{
@@ -3067,19 +4556,24 @@ do_literals:
 				// ancillary chunk - skip it
 			}
 
+			prev_chunk_was_idat = is_idat;
 			pImage_u8 += sizeof(png_chunk_prefix) + chunk_len + sizeof(uint32_t);
 		}
 
 		if ((!found_fdec_chunk) || (!idat_ofs))
 			return FPNG_DECODE_NOT_FPNG;
+
+		// Sanity check the IDAT chunk length
+		if (idat_len < 7)
+			return FPNG_DECODE_FAILED_INVALID_IDAT;
 		
 		return FPNG_DECODE_SUCCESS;
 	}
 
 	int fpng_get_info(const void* pImage, uint32_t image_size, uint32_t& width, uint32_t& height, uint32_t& channels_in_file)
 	{
-		uint32_t idat_ofs = 0, idat_len = 0;
-		return fpng_get_info_internal(pImage, image_size, width, height, channels_in_file, idat_ofs, idat_len);
+		uint32_t idat_ofs = 0, idat_len = 0, num_idats = 0;
+		return fpng_get_info_internal(pImage, image_size, width, height, channels_in_file, idat_ofs, idat_len, num_idats);
 	}
 
 	int fpng_decode_memory(const void *pImage, uint32_t image_size, std::vector<uint8_t> &out, uint32_t& width, uint32_t& height, uint32_t &channels_in_file, uint32_t desired_channels)
@@ -3095,8 +4589,8 @@ do_literals:
 			return FPNG_DECODE_INVALID_ARG;
 		}
 
-		uint32_t idat_ofs = 0, idat_len = 0;
-		int status = fpng_get_info_internal(pImage, image_size, width, height, channels_in_file, idat_ofs, idat_len);
+		uint32_t idat_ofs = 0, idat_len = 0, num_idats = 0;
+		int status = fpng_get_info_internal(pImage, image_size, width, height, channels_in_file, idat_ofs, idat_len, num_idats);
 		if (status)
 			return status;
 				
@@ -3111,7 +4605,25 @@ do_literals:
 		out.resize(mem_needed);
 		
 		const uint8_t* pIDAT_data = static_cast<const uint8_t*>(pImage) + idat_ofs + sizeof(uint32_t) * 2;
-		const uint32_t src_len = image_size - (idat_ofs + sizeof(uint32_t) * 2);
+		uint32_t src_len = image_size - (idat_ofs + sizeof(uint32_t) * 2);
+
+		// Join the data of multiple IDAT chunks, followed by room for the decoders' reads past its end
+		std::vector<uint8_t> joined_idats;
+		if (num_idats > 1)
+		{
+			joined_idats.reserve((size_t)idat_len + 16);
+			const uint8_t* pChunk = static_cast<const uint8_t*>(pImage) + idat_ofs;
+			for (uint32_t i = 0; i < num_idats; i++)
+			{
+				const uint32_t chunk_len = READ_BE32(pChunk);
+				joined_idats.insert(joined_idats.end(), pChunk + sizeof(uint32_t) * 2, pChunk + sizeof(uint32_t) * 2 + chunk_len);
+				pChunk += sizeof(uint32_t) * 3 + chunk_len;
+			}
+			joined_idats.resize((size_t)idat_len + 16);
+
+			pIDAT_data = joined_idats.data();
+			src_len = (uint32_t)joined_idats.size();
+		}
 
 		bool decomp_status;
 		if (desired_channels == 3)
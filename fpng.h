@@ -4,12 +4,18 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <vector>
+#include <string>
 
 #ifndef FPNG_TRAIN_HUFFMAN_TABLES
 	// Set to 1 when using the -t (training) option in fpng_test to generate new opaque/alpha Huffman tables for the single pass encoder.
 	#define FPNG_TRAIN_HUFFMAN_TABLES (0)
 #endif
 
+#ifndef FPNG_SELF_TEST
+	// Set to 1 to compile fpng_self_test(), which checks the SIMD, combined and parallel checksums against the scalar implementations.
+	#define FPNG_SELF_TEST (0)
+#endif
+
 namespace fpng
 {
 	// ---- Library initialization - call once to identify if the processor supports SSE.
@@ -22,6 +28,21 @@ namespace fpng
 	// fpng_init() must have been called first, or it'll assert and return false.
 	bool fpng_cpu_supports_sse41();
 
+	// ---- SIMD code paths. fpng_init() picks the widest one supported by the CPU and OS.
+	enum
+	{
+		FPNG_SIMD_SCALAR = 0,
+		FPNG_SIMD_SSE41 = 1,	// SSE 4.1 up filter and Adler-32, PCLMULQDQ CRC-32
+		FPNG_SIMD_AVX2 = 2		// AVX2 up filter, Adler-32 and RGBA run scanning, 256-bit VPCLMULQDQ CRC-32 where available
+	};
+
+	// Returns the code path in use, one of FPNG_SIMD_*.
+	uint32_t fpng_get_simd_level();
+
+	// Limits the kernels to the given code path, e.g. to benchmark the paths against each other, and returns the path in use, which is
+	// still limited by what the CPU supports. Must not be called while another thread encodes, decodes or computes a checksum.
+	uint32_t fpng_set_simd_level(uint32_t level);
+
 	// Fast CRC-32 SSE4.1+pclmul or a scalar fallback (slice by 4)
 	const uint32_t FPNG_CRC32_INIT = 0;
 	uint32_t fpng_crc32(const void* pData, size_t size, uint32_t prev_crc32 = FPNG_CRC32_INIT);
@@ -30,6 +51,24 @@ namespace fpng
 	const uint32_t FPNG_ADLER32_INIT = 1;
 	uint32_t fpng_adler32(const void* pData, size_t size, uint32_t adler = FPNG_ADLER32_INIT);
 
+	// Checksum of buffer A followed by buffer B, computed from the checksums of A and B and the length of B, so buffers hashed separately
+	// don't have to be hashed again as a whole. crc_b/adler_b must have been started from FPNG_CRC32_INIT/FPNG_ADLER32_INIT.
+	uint32_t fpng_crc32_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+	uint32_t fpng_adler32_combine(uint32_t adler_a, uint32_t adler_b, uint64_t len_b);
+
+	// Same results as fpng_crc32()/fpng_adler32(), but large buffers are split into parts that are hashed on separate threads and then combined.
+	// num_threads = 0 uses one thread per hardware thread.
+	uint32_t fpng_crc32_parallel(const void* pData, size_t size, uint32_t prev_crc32 = FPNG_CRC32_INIT, uint32_t num_threads = 0);
+	uint32_t fpng_adler32_parallel(const void* pData, size_t size, uint32_t adler = FPNG_ADLER32_INIT, uint32_t num_threads = 0);
+
+#if FPNG_SELF_TEST
+	// Compares fpng_crc32() and fpng_adler32() at every SIMD level the CPU supports, the combined checksums of buffers split at random points,
+	// and the parallel checksums with several thread counts against the scalar slice by 4 CRC-32 and Adler-32. At each level it also decodes
+	// images streamed with fpng_stream_encoder, some of whose bands don't compress and are stored. Restores the SIMD level in use afterwards.
+	// Returns the number of failed checks, 0 if all passed. fpng_init() must have been called first.
+	uint32_t fpng_self_test();
+#endif
+
 	// ---- Compression
 	enum
 	{
@@ -39,6 +78,14 @@ namespace fpng
 		
 		// Only use raw Deflate blocks (no compression at all). Intended for testing.
 		FPNG_FORCE_UNCOMPRESSED = 2,
+
+		// Filter each row with the one of None, Sub, Up, Average and Paeth that leaves the smallest differences, instead of always Up.
+		// Smooth gradients and images with large uniform areas compress 5-10% smaller, encoding takes about a quarter longer.
+		FPNG_ENCODE_ADAPTIVE_FILTERS = 4,
+
+		// Compress 4 channel images with Huffman tables trained on volume renders, which are mostly transparent black with smooth colors, instead of
+		// the tables trained on photos. Ignored by 3 channel images and FPNG_ENCODE_SLOWER, which build their tables from the image.
+		FPNG_ENCODE_VOLUME_TABLES = 8,
 	};
 
 	// Fast PNG encoding. The resulting file can be decoded either using a standard PNG decoder or by the fpng_decode_memory() function below.
@@ -47,6 +94,108 @@ namespace fpng
 	// num_chans must be 3 or 4. 
 	bool fpng_encode_image_to_memory(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, std::vector<uint8_t>& out_buf, uint32_t flags = 0);
 
+	// Same as above, but with an explicit row pitch in bytes, which may be negative. pImage points to the top row of the image and row y starts at
+	// pImage + y * row_pitch. An image stored bottom row first, like a glReadPixels()/glGetTexImage() result, is encoded by passing a pointer to its
+	// last row and row_pitch = -(w * num_chans), without flipping it first. abs(row_pitch) must be at least w*num_chans.
+	bool fpng_encode_image_to_memory(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, std::vector<uint8_t>& out_buf, uint32_t flags = 0);
+
+	// Multithreaded variant of the above. The image is split into horizontal strips of at least 32 rows, one per thread, which are filtered and deflated
+	// independently into byte aligned Deflate blocks of a single zlib stream, so the output is a standard PNG. The Adler-32 and IDAT CRC-32 of the
+	// strips are combined instead of hashing the whole output again. num_threads = 0 uses one thread per hardware thread.
+	// FPNG_ENCODE_SLOWER, FPNG_FORCE_UNCOMPRESSED and images with too few rows are encoded on the calling thread.
+	bool fpng_encode_image_to_memory_parallel(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, std::vector<uint8_t>& out_buf, uint32_t flags = 0, uint32_t num_threads = 0);
+
+	// Encoder context for encoding many images, e.g. the frames of a sequence. The stateless functions above allocate and zero-fill the filtered
+	// scanlines and a worst case sized output buffer on every call, the context keeps them, the strip buffers and the FPNG_ENCODE_SLOWER symbol
+	// buffers between calls, so images no larger than a previous one are encoded without allocating. The output is identical to the stateless functions.
+	// A context may only be used by one thread at a time, but encode_image() itself may use num_threads threads like fpng_encode_image_to_memory_parallel().
+	class fpng_encoder
+	{
+	public:
+		// Same parameters as fpng_encode_image_to_memory_parallel(), num_threads = 1 encodes on the calling thread.
+		// The PNG stays valid until the next call.
+		bool encode_image(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, uint32_t flags = 0, uint32_t num_threads = 1);
+
+		const uint8_t* get_png_data() const { return m_out.data(); }
+		size_t get_png_size() const { return m_png_size; }
+
+		// Copies the PNG into out_buf
+		void get_png(std::vector<uint8_t>& out_buf) const { out_buf.assign(m_out.data(), m_out.data() + m_png_size); }
+		// Moves the PNG into out_buf without copying it, the context has to allocate its output buffer again on the next call
+		void take_png(std::vector<uint8_t>& out_buf);
+
+		// Frees all buffers
+		void clear();
+		// Bytes held by the buffers
+		size_t get_memory_size() const;
+
+	private:
+		struct strip
+		{
+			uint32_t m_first_row, m_num_rows;
+			std::vector<uint8_t> m_defl;
+			uint32_t m_defl_size, m_defl_crc32, m_adler32;
+		};
+
+		bool encode_serial(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, uint32_t flags);
+		bool encode_strips(const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, int64_t row_pitch, uint32_t flags, uint32_t num_strips);
+
+		std::vector<uint8_t> m_filtered;		// filtered scanlines of the whole image
+		std::vector<uint8_t> m_out;				// the PNG, followed by unused room for the worst case
+		size_t m_png_size = 0;
+		std::vector<strip> m_strips;
+		std::vector<uint32_t> m_codes_3;		// FPNG_ENCODE_SLOWER symbols of the first pass
+		std::vector<uint64_t> m_codes_4;
+	};
+
+	// Streaming encoder, which takes the image in pieces from top to bottom and writes the PNG while they arrive. Incoming rows are filtered into a band
+	// of about 1 MB, which is compressed and written as its own IDAT chunk once full, so neither the image nor a filtered copy of it has to be held,
+	// and the height isn't limited to FPNG_MAX_SUPPORTED_DIM. The zlib stream continues across the chunks, so the result is a standard PNG, which
+	// fpng_decode_memory() also decodes if its dimensions are supported. A stream encoder may only be used by one thread at a time.
+	class fpng_stream_encoder
+	{
+	public:
+		// Receives consecutive pieces of the PNG, returns false on failure, which aborts the image
+		typedef bool (*write_func)(const void* pData, size_t size, void* pUser);
+
+		// Starts an image of h < 2^31 rows and writes its header, flags may be FPNG_ENCODE_ADAPTIVE_FILTERS
+		bool begin(uint32_t w, uint32_t h, uint32_t num_chans, write_func pWrite, void* pUser, uint32_t flags = 0);
+		// Same, but writes to a file descriptor, which is left open
+		bool begin(uint32_t w, uint32_t h, uint32_t num_chans, int fd, uint32_t flags = 0);
+
+		// Adds the next num_rows rows, row y starting at pRows + y * row_pitch like in fpng_encode_image_to_memory()
+		bool add_rows(const void* pRows, uint32_t num_rows, int64_t row_pitch);
+
+		// Adds a tile of the next row of tiles, which are given left to right starting at x = 0 and have the same height, row y of the tile
+		// starting at pTile + y * row_pitch. Only one row of tiles is held until its last tile completes it.
+		bool add_tile(uint32_t x, const void* pTile, uint32_t tile_w, uint32_t tile_h, int64_t row_pitch);
+
+		// Writes the end of the PNG, all rows must have been added
+		bool end();
+
+		uint64_t get_bytes_written() const { return m_bytes_written; }
+
+	private:
+		bool write(const void* pData, size_t size);
+		bool flush_band();
+
+		write_func m_pWrite = nullptr;
+		void* m_pUser = nullptr;
+		bool m_active = false;
+
+		uint32_t m_w = 0, m_h = 0, m_num_chans = 0, m_bpl = 0, m_flags = 0;
+		uint32_t m_band_rows = 0;			// rows compressed together
+		uint32_t m_rows_added = 0, m_band_rows_filtered = 0;
+		uint32_t m_adler32 = 0;				// of all filtered rows so far
+		uint32_t m_tile_x = 0, m_tile_h = 0;	// end and height of the tiles added to the current row of tiles
+		uint64_t m_bytes_written = 0;
+
+		std::vector<uint8_t> m_prev_row;	// last row of the previous call, which the next row is filtered against
+		std::vector<uint8_t> m_filtered;	// filtered rows of the current band
+		std::vector<uint8_t> m_idat;		// IDAT chunk of the current band
+		std::vector<uint8_t> m_tile_rows;	// current row of tiles
+	};
+
 #ifndef FPNG_NO_STDIO
 	// Fast PNG encoding to the specified file.
 	bool fpng_encode_image_to_file(const char* pFilename, const void* pImage, uint32_t w, uint32_t h, uint32_t num_chans, uint32_t flags = 0);
@@ -116,7 +265,9 @@ namespace fpng
 #if FPNG_TRAIN_HUFFMAN_TABLES
 	const uint32_t HUFF_COUNTS_SIZE = 288;
 	extern uint64_t g_huff_counts[HUFF_COUNTS_SIZE];
-	bool create_dynamic_block_prefix(uint64_t* pFreq, uint32_t num_chans, std::vector<uint8_t>& prefix, uint64_t& bit_buf, int& bit_buf_size, uint32_t *pCodes, uint8_t *pCodesizes);
+	bool create_dynamic_block_prefix(const uint64_t* pFreq, uint32_t num_chans, std::vector<uint8_t>& prefix, uint64_t& bit_buf, int& bit_buf_size, uint32_t *pCodes, uint8_t *pCodesizes);
+	// Writes the C++ source of a one-pass table set built from the symbol counts, named g_dyn_huff_<pName>, like the tables in fpng.cpp
+	bool create_huffman_table_source(const uint64_t* pFreq, uint32_t num_chans, const char* pName, std::string& source);
 #endif
 
 } // namespace fpng
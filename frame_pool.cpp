@@ -0,0 +1,119 @@
+#include "frame_pool.h"
+
+#include <new>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+frame_pool::frame& frame_pool::frame::operator=(frame&& other) noexcept {
+
+	if(this != &other) {
+		reset();
+		pool = other.pool;
+		ptr = other.ptr;
+		other.pool = nullptr;
+		other.ptr = nullptr;
+	}
+	return *this;
+}
+
+void frame_pool::frame::reset() {
+
+	if(ptr)
+		pool->release(ptr);
+	pool = nullptr;
+	ptr = nullptr;
+}
+
+void frame_pool::init(size_t _frame_bytes, size_t count, bool _huge_pages) {
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(_frame_bytes != frame_bytes || _huge_pages != huge_pages) {
+		for(uint8_t* ptr : free_buffers)
+			deallocate(ptr, frame_bytes);
+		free_buffers.clear();
+		num_allocated = 0;
+		frame_bytes = _frame_bytes;
+		huge_pages = _huge_pages;
+	}
+
+	while(num_allocated < count) {
+		free_buffers.push_back(allocate(frame_bytes, huge_pages));
+		++num_allocated;
+	}
+}
+
+void frame_pool::clear() {
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for(uint8_t* ptr : free_buffers)
+		deallocate(ptr, frame_bytes);
+	free_buffers.clear();
+	free_buffers.shrink_to_fit();
+	num_allocated = 0;
+	frame_bytes = 0;
+}
+
+frame_pool::frame frame_pool::acquire() {
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if(free_buffers.empty()) {
+		++num_allocated;
+		return frame(this, allocate(frame_bytes, huge_pages));
+	}
+
+	uint8_t* ptr = free_buffers.back();
+	free_buffers.pop_back();
+	return frame(this, ptr);
+}
+
+void frame_pool::release(uint8_t* ptr) {
+
+	std::lock_guard<std::mutex> lock(mutex);
+	free_buffers.push_back(ptr);
+}
+
+uint8_t* frame_pool::allocate(size_t bytes, bool huge_pages) {
+
+	// whole pages keep the rows aligned for vector loads and let the system back the buffer with huge pages
+#ifdef _WIN32
+	void* ptr = nullptr;
+	if(huge_pages) {
+		// large pages need the lock pages privilege, fall back to normal pages without it
+		const size_t large_page = GetLargePageMinimum();
+		if(large_page > 0)
+			ptr = VirtualAlloc(nullptr, (bytes + large_page - 1) / large_page * large_page, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE);
+	}
+	if(!ptr)
+		ptr = VirtualAlloc(nullptr, bytes, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if(!ptr)
+		throw std::bad_alloc();
+#else
+	void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ptr == MAP_FAILED)
+		throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+	if(huge_pages)
+		madvise(ptr, bytes, MADV_HUGEPAGE);
+#endif
+#endif
+	return static_cast<uint8_t*>(ptr);
+}
+
+void frame_pool::deallocate(uint8_t* ptr, size_t bytes) {
+
+#ifdef _WIN32
+	VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+	munmap(ptr, bytes);
+#endif
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/// pool of equally sized, page aligned frame buffers that are handed out and returned instead of being allocated per frame;
+/// buffers can be acquired and returned from any thread
+class frame_pool
+{
+public:
+	/// buffer taken from the pool that is given back when the handle is destroyed
+	class frame {
+	public:
+		frame() = default;
+		frame(frame&& other) noexcept : pool(other.pool), ptr(other.ptr) { other.pool = nullptr; other.ptr = nullptr; }
+		frame& operator=(frame&& other) noexcept;
+		~frame() { reset(); }
+
+		frame(const frame&) = delete;
+		frame& operator=(const frame&) = delete;
+
+		uint8_t* data() const { return ptr; }
+		bool empty() const { return ptr == nullptr; }
+		/// give the buffer back to its pool
+		void reset();
+
+	private:
+		friend class frame_pool;
+		frame(frame_pool* _pool, uint8_t* _ptr) : pool(_pool), ptr(_ptr) {}
+
+		frame_pool* pool = nullptr;
+		uint8_t* ptr = nullptr;
+	};
+
+	frame_pool() = default;
+	~frame_pool() { clear(); }
+
+	frame_pool(const frame_pool&) = delete;
+	frame_pool& operator=(const frame_pool&) = delete;
+
+	/// make at least count buffers of frame_bytes available, keeping the current ones if their size and backing match;
+	/// huge_pages asks the system to back the buffers with huge pages where supported. All frames must have been returned.
+	void init(size_t frame_bytes, size_t count, bool huge_pages);
+	/// free all buffers, all frames must have been returned
+	void clear();
+
+	/// take a free buffer, a new one is only allocated if all buffers are in use
+	frame acquire();
+
+	size_t get_frame_bytes() const { return frame_bytes; }
+	/// number of buffers allocated by the pool, whether in use or not
+	size_t get_num_allocated() const { return num_allocated; }
+
+private:
+	void release(uint8_t* ptr);
+
+	static uint8_t* allocate(size_t bytes, bool huge_pages);
+	static void deallocate(uint8_t* ptr, size_t bytes);
+
+	std::mutex mutex;
+	std::vector<uint8_t*> free_buffers;
+	size_t num_allocated = 0;
+	size_t frame_bytes = 0;
+	bool huge_pages = false;
+};
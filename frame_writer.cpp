@@ -0,0 +1,81 @@
+#include "frame_writer.h"
+
+#include <algorithm>
+#include <chrono>
+
+void frame_writer::start(unsigned num_threads, size_t _capacity, write_function _write) {
+
+	finish();
+
+	write = std::move(_write);
+	capacity = std::max<size_t>(1, _capacity);
+	stopping = false;
+	num_failed = 0;
+	stall_ms = 0.0;
+
+	num_threads = std::max(1u, num_threads);
+	workers.reserve(num_threads);
+	for(unsigned t = 0; t < num_threads; ++t)
+		workers.emplace_back(&frame_writer::work, this);
+}
+
+void frame_writer::push(const std::string& file_name, frame_pool::frame&& pixels, unsigned width, unsigned height) {
+
+	std::unique_lock<std::mutex> lock(mutex);
+
+	if(queue.size() >= capacity) {
+		const auto stall_start = std::chrono::steady_clock::now();
+		frame_taken.wait(lock, [this] { return queue.size() < capacity; });
+		stall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stall_start).count();
+	}
+
+	queue.push_back({ file_name, std::move(pixels), width, height });
+	lock.unlock();
+	frame_queued.notify_one();
+}
+
+size_t frame_writer::finish() {
+
+	if(workers.empty())
+		return num_failed;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	frame_queued.notify_all();
+
+	// workers only exit once the queue is empty
+	for(auto& worker : workers)
+		worker.join();
+	workers.clear();
+
+	return num_failed;
+}
+
+void frame_writer::work() {
+
+	fpng::fpng_encoder encoder;
+
+	for(;;) {
+		frame f;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			frame_queued.wait(lock, [this] { return stopping || !queue.empty(); });
+			if(queue.empty())
+				return;
+
+			f = std::move(queue.front());
+			queue.pop_front();
+		}
+		frame_taken.notify_one();
+
+		const bool written = write(f.file_name, f.pixels.data(), f.width, f.height, encoder);
+		f.pixels.reset();
+
+		if(!written) {
+			std::lock_guard<std::mutex> lock(mutex);
+			++num_failed;
+		}
+	}
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fpng.h"
+#include "frame_pool.h"
+
+/// bounded queue of raw frames drained by worker threads that encode and write them, so that the thread producing
+/// the frames only has to wait when the queue is full
+class frame_writer
+{
+public:
+	/// write(file_name, pixels, width, height, encoder) encodes and writes one RGBA8 frame and returns whether it succeeded,
+	/// encoder is owned by the worker and keeps its buffers between frames
+	using write_function = std::function<bool(const std::string&, const uint8_t*, unsigned, unsigned, fpng::fpng_encoder&)>;
+
+	~frame_writer() { finish(); }
+
+	/// start num_threads workers that accept at most capacity queued frames, finishing any previous run first
+	void start(unsigned num_threads, size_t capacity, write_function write);
+	/// hand a frame over to the workers, blocking while the queue is full; the frame goes back to its pool once written
+	void push(const std::string& file_name, frame_pool::frame&& pixels, unsigned width, unsigned height);
+	/// wait until all queued frames are written and stop the workers; returns the number of frames that failed to be written
+	size_t finish();
+
+	bool is_running() const { return !workers.empty(); }
+	/// accumulated time the producer spent blocked in push because the queue was full
+	double get_stall_ms() const { return stall_ms; }
+
+private:
+	struct frame {
+		std::string file_name;
+		frame_pool::frame pixels;
+		unsigned width = 0;
+		unsigned height = 0;
+	};
+
+	void work();
+
+	std::vector<std::thread> workers;
+	write_function write;
+	size_t capacity = 1;
+
+	std::mutex mutex;
+	/// signaled when a frame was queued or the workers should stop
+	std::condition_variable frame_queued;
+	/// signaled when a worker took a frame out of the queue
+	std::condition_variable frame_taken;
+	std::deque<frame> queue;
+	bool stopping = false;
+	size_t num_failed = 0;
+	double stall_ms = 0.0;
+};
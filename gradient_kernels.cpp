@@ -0,0 +1,77 @@
+#include "gradient_kernels.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRADIENT_KERNELS_SSE2 1
+#include <emmintrin.h>
+#else
+#define GRADIENT_KERNELS_SSE2 0
+#endif
+
+namespace {
+
+// central differences of values in [0,1] have components of at most 0.5
+const float max_magnitude = 0.5f * std::sqrt(3.0f);
+// maps the magnitude to the alpha channel, shared with the SIMD path so both produce the same texels
+const float magnitude_scale = 127.0f / max_magnitude;
+
+void pack_gradient(float gx, float gy, float gz, int8_t* dst) {
+
+	const float magnitude = std::sqrt(gx * gx + gy * gy + gz * gz);
+	const float inv_magnitude = magnitude > 0.0f ? 127.0f / magnitude : 0.0f;
+
+	// round to nearest even like _mm_cvtps_epi32 in the default rounding mode
+	dst[0] = static_cast<int8_t>(std::nearbyint(gx * inv_magnitude));
+	dst[1] = static_cast<int8_t>(std::nearbyint(gy * inv_magnitude));
+	dst[2] = static_cast<int8_t>(std::nearbyint(gz * inv_magnitude));
+	dst[3] = static_cast<int8_t>(std::nearbyint(std::min(magnitude * magnitude_scale, 127.0f)));
+}
+
+}
+
+void pack_central_differences(const float* row, const float* y_minus, const float* y_plus, const float* z_minus, const float* z_plus, size_t count, int8_t* dst) {
+
+	if(count == 0)
+		return;
+
+	const auto pack_scalar = [&](size_t x) {
+		const float x_minus = row[x > 0 ? x - 1 : x];
+		const float x_plus = row[x + 1 < count ? x + 1 : x];
+		pack_gradient(0.5f * (x_plus - x_minus), 0.5f * (y_plus[x] - y_minus[x]), 0.5f * (z_plus[x] - z_minus[x]), dst + 4 * x);
+	};
+
+	pack_scalar(0);
+	size_t x = 1;
+
+#if GRADIENT_KERNELS_SSE2
+	// 4 voxels per iteration away from the row ends, the four components of each texel are combined with shifts into one 32 bit lane
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 scale = _mm_set1_ps(127.0f);
+	const __m128 alpha_scale = _mm_set1_ps(magnitude_scale);
+	const __m128i byte_mask = _mm_set1_epi32(0xff);
+
+	for(; x + 4 < count; x += 4) {
+		const __m128 gx = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(row + x + 1), _mm_loadu_ps(row + x - 1)));
+		const __m128 gy = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(y_plus + x), _mm_loadu_ps(y_minus + x)));
+		const __m128 gz = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(z_plus + x), _mm_loadu_ps(z_minus + x)));
+
+		const __m128 magnitude = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gy, gy)), _mm_mul_ps(gz, gz)));
+		const __m128 nonzero = _mm_cmpgt_ps(magnitude, zero);
+		const __m128 inv_magnitude = _mm_and_ps(nonzero, _mm_div_ps(scale, _mm_or_ps(magnitude, _mm_andnot_ps(nonzero, scale))));
+
+		const __m128i nx = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(gx, inv_magnitude)), byte_mask);
+		const __m128i ny = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(gy, inv_magnitude)), byte_mask);
+		const __m128i nz = _mm_and_si128(_mm_cvtps_epi32(_mm_mul_ps(gz, inv_magnitude)), byte_mask);
+		const __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_mul_ps(magnitude, alpha_scale), scale));
+
+		const __m128i texels = _mm_or_si128(_mm_or_si128(nx, _mm_slli_epi32(ny, 8)), _mm_or_si128(_mm_slli_epi32(nz, 16), _mm_slli_epi32(a, 24)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * x), texels);
+	}
+#endif
+
+	for(; x < count; ++x)
+		pack_scalar(x);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Kernels used to precompute the gradient volume.
+
+/// write the central difference gradients of count voxels of a row of normalized float voxels as signed normalized RGBA8 texels,
+/// with the gradient direction in RGB and its magnitude relative to the largest possible magnitude in A; the neighboring rows
+/// along y and z are passed explicitly and equal the row itself at the volume border, as does the missing neighbor at both row ends
+void pack_central_differences(const float* row, const float* y_minus, const float* y_plus, const float* z_minus, const float* z_plus, size_t count, int8_t* dst);
@@ -0,0 +1,133 @@
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+mapped_file::~mapped_file()
+{
+	close();
+}
+
+bool mapped_file::open(const std::string& file_name)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!view) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_handle = file;
+	mapping_handle = mapping;
+	data_ptr = static_cast<const uint8_t*>(view);
+	data_size = static_cast<size_t>(file_size.QuadPart);
+#else
+	int fd = ::open(file_name.c_str(), O_RDONLY);
+	if(fd < 0)
+		return false;
+
+	struct stat file_stat;
+	if(fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	void* view = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+	if(view == MAP_FAILED) {
+		::close(fd);
+		return false;
+	}
+
+	file_descriptor = fd;
+	data_ptr = static_cast<const uint8_t*>(view);
+	data_size = static_cast<size_t>(file_stat.st_size);
+#endif
+
+	return true;
+}
+
+void mapped_file::close()
+{
+#ifdef _WIN32
+	if(data_ptr)
+		UnmapViewOfFile(data_ptr);
+	if(mapping_handle)
+		CloseHandle(mapping_handle);
+	if(file_handle)
+		CloseHandle(file_handle);
+	file_handle = nullptr;
+	mapping_handle = nullptr;
+#else
+	if(data_ptr)
+		munmap(const_cast<uint8_t*>(data_ptr), data_size);
+	if(file_descriptor >= 0)
+		::close(file_descriptor);
+	file_descriptor = -1;
+#endif
+
+	data_ptr = nullptr;
+	data_size = 0;
+}
+
+void mapped_file::swap(mapped_file& other)
+{
+	std::swap(data_ptr, other.data_ptr);
+	std::swap(data_size, other.data_size);
+#ifdef _WIN32
+	std::swap(file_handle, other.file_handle);
+	std::swap(mapping_handle, other.mapping_handle);
+#else
+	std::swap(file_descriptor, other.file_descriptor);
+#endif
+}
+
+void mapped_file::advise_sequential(size_t offset, size_t length) const
+{
+	if(!data_ptr || offset >= data_size)
+		return;
+
+	if(length > data_size - offset)
+		length = data_size - offset;
+
+#ifdef _WIN32
+	WIN32_MEMORY_RANGE_ENTRY range;
+	range.VirtualAddress = const_cast<uint8_t*>(data_ptr + offset);
+	range.NumberOfBytes = length;
+	PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+	// madvise requires a page aligned start address
+	const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const size_t aligned_offset = offset & ~(page_size - 1);
+	madvise(const_cast<uint8_t*>(data_ptr + aligned_offset), length + (offset - aligned_offset), MADV_WILLNEED);
+#endif
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// read-only memory mapping of a whole file, used to access large volume files without copying them into host memory
+class mapped_file
+{
+public:
+	mapped_file() = default;
+	~mapped_file();
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	/// map the given file, closing any previously mapped file; returns false if the file could not be opened or mapped
+	bool open(const std::string& file_name);
+	/// unmap the file and release the file handle
+	void close();
+	/// exchange the mappings of both objects, so a file can be opened and checked before it replaces the current one
+	void swap(mapped_file& other);
+
+	bool is_open() const { return data_ptr != nullptr; }
+	const uint8_t* data() const { return data_ptr; }
+	size_t size() const { return data_size; }
+
+	/// hint the operating system that the given byte range will be read sequentially soon, so it can prefetch the pages
+	void advise_sequential(size_t offset, size_t length) const;
+
+private:
+	const uint8_t* data_ptr = nullptr;
+	size_t data_size = 0;
+
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
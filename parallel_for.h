@@ -0,0 +1,61 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Minimal helpers to spread CPU side volume passes over all cores. The calling thread always takes part in the work.
+
+/// number of threads used by the parallel helpers
+inline unsigned get_worker_count() {
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+/// call f(thread_index, item) for every item in [0, num_items), handing out items dynamically so uneven items balance out
+template <typename F>
+void parallel_for_each(size_t num_items, F&& f) {
+
+	const unsigned num_threads = static_cast<unsigned>(std::min<size_t>(get_worker_count(), num_items));
+	if(num_threads <= 1) {
+		for(size_t item = 0; item < num_items; ++item)
+			f(0u, item);
+		return;
+	}
+
+	std::atomic<size_t> next_item(0);
+	const auto work = [&](unsigned thread_index) {
+		for(size_t item = next_item++; item < num_items; item = next_item++)
+			f(thread_index, item);
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(num_threads - 1);
+	for(unsigned t = 1; t < num_threads; ++t)
+		threads.emplace_back(work, t);
+
+	work(0u);
+
+	for(auto& thread : threads)
+		thread.join();
+}
+
+/// split [begin, end) into one contiguous range per thread of at least min_range items and call f(thread_index, range_begin, range_end) for each
+template <typename F>
+void parallel_for_ranges(size_t begin, size_t end, size_t min_range, F&& f) {
+
+	if(end <= begin)
+		return;
+
+	const size_t count = end - begin;
+	const size_t num_ranges = std::max<size_t>(1, std::min<size_t>(get_worker_count(), count / std::max<size_t>(min_range, 1)));
+	const size_t range_size = (count + num_ranges - 1) / num_ranges;
+
+	parallel_for_each(num_ranges, [&](unsigned thread_index, size_t range) {
+		const size_t range_begin = begin + range * range_size;
+		const size_t range_end = std::min(end, range_begin + range_size);
+		if(range_begin < range_end)
+			f(thread_index, range_begin, range_end);
+	});
+}
@@ -0,0 +1,75 @@
+#include "readback_ring.h"
+
+void readback_ring::init(size_t depth, unsigned width, unsigned height) {
+
+	destruct();
+
+	frame_bytes = static_cast<size_t>(width) * height * 4;
+	slots.resize(depth > 0 ? depth : 1);
+
+	for(auto& s : slots) {
+		glGenBuffers(1, &s.buffer);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+		glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(frame_bytes), nullptr, GL_STREAM_READ);
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+void readback_ring::destruct() {
+
+	for(auto& s : slots) {
+		if(s.fence)
+			glDeleteSync(s.fence);
+		if(s.buffer)
+			glDeleteBuffers(1, &s.buffer);
+	}
+
+	slots.clear();
+	oldest = 0;
+	num_pending = 0;
+	frame_bytes = 0;
+}
+
+void readback_ring::issue(size_t frame) {
+
+	slot& s = slots[(oldest + num_pending) % slots.size()];
+	s.frame = frame;
+
+	// with a pack buffer bound the pixel pointer is an offset into the buffer and the call returns without waiting for the copy
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	++num_pending;
+}
+
+const uint8_t* readback_ring::map_oldest(size_t& frame) {
+
+	slot& s = slots[oldest];
+	frame = s.frame;
+
+	// flush once so that the fence is guaranteed to signal, then block until the copy is done
+	if(s.fence) {
+		const GLuint64 timeout_ns = 1000000000u;
+		GLenum result = glClientWaitSync(s.fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout_ns);
+		while(result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(s.fence, 0, timeout_ns);
+		glDeleteSync(s.fence);
+		s.fence = nullptr;
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, s.buffer);
+	return static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, static_cast<GLsizeiptr>(frame_bytes), GL_MAP_READ_BIT));
+}
+
+void readback_ring::unmap_oldest() {
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[oldest].buffer);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	oldest = (oldest + 1) % slots.size();
+	--num_pending;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <cgv_gl/gl/gl.h>
+
+/// ring of pixel pack buffers that lets the readback of rendered frames overlap with rendering the following frames;
+/// frames are retrieved in the order they were issued and all methods need the GL context to be current
+class readback_ring
+{
+public:
+	/// (re)allocate depth buffers for RGBA8 frames of the given size, dropping pending frames
+	void init(size_t depth, unsigned width, unsigned height);
+	/// release all buffers and pending fences
+	void destruct();
+
+	size_t get_depth() const { return slots.size(); }
+	/// whether every buffer holds a frame that was not retrieved yet
+	bool full() const { return num_pending == slots.size(); }
+	bool empty() const { return num_pending == 0; }
+
+	/// start an asynchronous copy of level 0 of the texture bound to GL_TEXTURE_2D into the next buffer, the ring must not be full
+	void issue(size_t frame);
+	/// wait until the oldest pending frame has arrived and map it; returns the RGBA8 pixels, bottom row first, and stores the frame index
+	const uint8_t* map_oldest(size_t& frame);
+	/// unmap the frame returned by map_oldest and free its buffer for the next issue
+	void unmap_oldest();
+
+private:
+	struct slot {
+		GLuint buffer = 0;
+		GLsync fence = nullptr;
+		size_t frame = 0;
+	};
+
+	std::vector<slot> slots;
+	/// index of the slot holding the oldest pending frame
+	size_t oldest = 0;
+	size_t num_pending = 0;
+	size_t frame_bytes = 0;
+};
@@ -1,6 +1,7 @@
 #include "slice_renderer.h"
 
 #include <chrono>
+#include <cmath>
 #include <filesystem>
 #include <cgv/defines/quote.h>
 #include <cgv/gui/trigger.h>
@@ -19,15 +20,29 @@
 
 #include "cgv/media/image/image_writer.h"
 
+#include <cstring>
 #include <fstream>
+#include <limits>
+#include <tuple>
+#include <type_traits>
 
 #include "fpng.h"
+#include "gradient_kernels.h"
+#include "parallel_for.h"
+#include "splat_kernels.h"
+#include "voxel_conversion.h"
 #include <nlohmann/json.hpp>
 
 using json = nlohmann::json;
 
 namespace cgv {
 	namespace reflect {
+		enum_reflection_traits<slice_renderer::volume_storage_mode> get_reflection_traits(const slice_renderer::volume_storage_mode&) {
+			return enum_reflection_traits<slice_renderer::volume_storage_mode>("native,float32");
+		}
+		enum_reflection_traits<slice_renderer::volume_generator> get_reflection_traits(const slice_renderer::volume_generator&) {
+			return enum_reflection_traits<slice_renderer::volume_generator>("scatter,gather");
+		}
 	}
 }
 
@@ -46,13 +61,27 @@ slice_renderer::slice_renderer() : application_plugin("Slice Renderer")
 	
 
 	// configure texture format, filtering and wrapping (no context necessary)
-	volume_tex = cgv::render::texture("flt32[R]");
-	volume_tex.set_min_filter(cgv::render::TF_LINEAR);
-	volume_tex.set_mag_filter(cgv::render::TF_LINEAR);
-	volume_tex.set_wrap_s(cgv::render::TW_CLAMP_TO_BORDER);
-	volume_tex.set_wrap_t(cgv::render::TW_CLAMP_TO_BORDER);
-	volume_tex.set_wrap_r(cgv::render::TW_CLAMP_TO_BORDER);
-	volume_tex.set_border_color(0.0f, 0.0f, 0.0f, 0.0f);
+	vol_type = cgv::type::info::TypeId::TI_FLT32;
+	vol_value_scale = 1.0f;
+	vol_value_offset = 0.0f;
+	vol_data_offset = 0;
+	storage_mode = VSM_NATIVE;
+	generator = VG_GATHER;
+	parallel_conversion = true;
+	export_visible_only = false;
+	memory_budget_mb = 4096;
+	do_calculate_gradients = false;
+	show_gradient_histogram = false;
+	histogram_min_gradient = 0.0f;
+	histogram_max_gradient = 1.0f;
+	gradient_tex = cgv::render::texture("int8[R,G,B,A]");
+	gradient_tex.set_min_filter(cgv::render::TF_LINEAR);
+	gradient_tex.set_mag_filter(cgv::render::TF_LINEAR);
+	gradient_tex.set_wrap_s(cgv::render::TW_CLAMP_TO_EDGE);
+	gradient_tex.set_wrap_t(cgv::render::TW_CLAMP_TO_EDGE);
+	gradient_tex.set_wrap_r(cgv::render::TW_CLAMP_TO_EDGE);
+	proxy_res = uvec3(0u);
+	configure_volume_texture(vol_type);
 
 	vstyle.enable_depth_test = false;
 
@@ -86,12 +115,44 @@ slice_renderer::slice_renderer() : application_plugin("Slice Renderer")
 	transfer_function_legend_ptr->set_title("Density");
 	transfer_function_legend_ptr->set_visibility(false);
 
+	readback_ring_depth = 3;
+	encode_thread_count = static_cast<int>(std::max(1u, get_worker_count() - 1));
+	adaptive_png_filters = true;
+	volume_png_tables = true;
+#if FPNG_TRAIN_HUFFMAN_TABLES
+	train_png_tables = false;
+#endif
+	batch_mode = false;
+	batch_preset = -1;
+	batch_seed = -1;
+	num_failed_samples = 0;
+	cgv::signal::connect(batch_trigger.shoot, this, &slice_renderer::run_batch);
+
 	fpng::fpng_init();
+#if FPNG_SELF_TEST
+	if(const uint32_t num_failures = fpng::fpng_self_test())
+		std::cout << "Error: " << num_failures << " fpng checksum self test checks failed." << std::endl;
+	else
+		std::cout << "fpng checksum self test passed" << std::endl;
+#endif
 }
 
 void slice_renderer::stream_stats(std::ostream& os)
 {
 	os << "slice_renderer: resolution=" << vres[0] << "x" << vres[1] << "x" << vres[2] << std::endl;
+	if(!vol_stats.empty()) {
+		os << "slice_renderer: values min=" << vol_stats.get_min() << " max=" << vol_stats.get_max() << " mean=" << vol_stats.get_mean();
+		if(vol_stats.has_nonempty_box()) {
+			const unsigned* begin = vol_stats.get_nonempty_begin();
+			const unsigned* end = vol_stats.get_nonempty_end();
+			os << ", non-empty voxels in [" << begin[0] << "," << begin[1] << "," << begin[2] << "]-[" << end[0] << "," << end[1] << "," << end[2] << ")";
+		}
+		os << std::endl;
+	}
+	if(!vol_bricks.empty())
+		os << "slice_renderer: visible bricks=" << vol_bricks.get_num_visible() << "/" << vol_bricks.get_num_bricks() << std::endl;
+	if(vol_cache.is_open())
+		os << "slice_renderer: proxy=" << proxy_res[0] << "x" << proxy_res[1] << "x" << proxy_res[2] << ", brick cache hits=" << vol_cache.get_num_hits() << " misses=" << vol_cache.get_num_misses() << std::endl;
 }
 
 bool slice_renderer::self_reflect(cgv::reflect::reflection_handler& rh)
@@ -101,7 +162,27 @@ bool slice_renderer::self_reflect(cgv::reflect::reflection_handler& rh)
 		rh.reflect_member("randomize_zoom", randomize_zoom) &&
 		rh.reflect_member("randomize_offset", randomize_offset) &&
 		rh.reflect_member("sample_width", sample_width) &&
-		rh.reflect_member("sample_height", sample_height);
+		rh.reflect_member("sample_height", sample_height) &&
+		rh.reflect_member("storage_mode", storage_mode) &&
+		rh.reflect_member("generator", generator) &&
+		rh.reflect_member("parallel_conversion", parallel_conversion) &&
+		rh.reflect_member("export_visible_only", export_visible_only) &&
+		rh.reflect_member("memory_budget_mb", memory_budget_mb) &&
+		rh.reflect_member("do_calculate_gradients", do_calculate_gradients) &&
+		rh.reflect_member("show_gradient_histogram", show_gradient_histogram) &&
+		rh.reflect_member("histogram_min_gradient", histogram_min_gradient) &&
+		rh.reflect_member("histogram_max_gradient", histogram_max_gradient) &&
+		rh.reflect_member("readback_ring_depth", readback_ring_depth) &&
+		rh.reflect_member("encode_thread_count", encode_thread_count) &&
+		rh.reflect_member("adaptive_png_filters", adaptive_png_filters) &&
+		rh.reflect_member("volume_png_tables", volume_png_tables) &&
+#if FPNG_TRAIN_HUFFMAN_TABLES
+		rh.reflect_member("train_png_tables", train_png_tables) &&
+#endif
+		rh.reflect_member("batch_mode", batch_mode) &&
+		rh.reflect_member("batch_volume_file", batch_volume_file) &&
+		rh.reflect_member("batch_preset", batch_preset) &&
+		rh.reflect_member("batch_seed", batch_seed);
 			
 }
 
@@ -197,6 +278,28 @@ void slice_renderer::on_set(void* member_ptr)
 	if(member_ptr == &transfer_function_preset_idx)
 		load_transfer_function_preset();
 
+	// reload a volume from disk so it is stored with the newly selected storage mode
+	if(member_ptr == &storage_mode && !vol_file_name.empty())
+		load_volume_from_file(vol_file_name);
+
+	// shade with the precomputed gradients instead of differencing in the shader
+	if(member_ptr == &do_calculate_gradients) {
+		vstyle.use_gradient_texture = do_calculate_gradients;
+		update_member(&vstyle.use_gradient_texture);
+	}
+
+	// the 2d histogram is computed when first shown, changing the gradient band only sums it up again
+	if(member_ptr == &show_gradient_histogram && show_gradient_histogram && gradient_histogram.empty())
+		create_gradient_histogram();
+	if(member_ptr == &show_gradient_histogram || member_ptr == &histogram_min_gradient || member_ptr == &histogram_max_gradient)
+		update_histogram_display();
+
+	// regenerate the default volume with the newly selected generator
+	if(member_ptr == &generator && vol_file_name.empty()) {
+		if(auto ctx_ptr = get_context())
+			create_volume(*ctx_ptr);
+	}
+
 	update_member(member_ptr);
 	post_redraw();
 }
@@ -239,6 +342,10 @@ void slice_renderer::init_frame(cgv::render::context& ctx) {
 				transfer_function_editor_ptr->set_color_map(&transfer_function);
 			if(transfer_function_legend_ptr)
 				transfer_function_legend_ptr->set_color_map(ctx, transfer_function);
+
+			// the batch renders frames itself, so it is started from the event loop once the viewer is up
+			if(batch_mode)
+				batch_trigger.schedule_one_shot(0.5);
 		}
 	}
 
@@ -261,9 +368,14 @@ void slice_renderer::draw(cgv::render::context& ctx)
 
 	
 	// render the volume
+	// the gradients are computed once per volume when first needed
+	if(do_calculate_gradients && !gradient_tex.is_created())
+		create_gradient_texture(ctx);
+
 	auto& vr = cgv::render::ref_volume_renderer(ctx);
 	vr.set_render_style(vstyle);
 	vr.set_volume_texture(&volume_tex); // set volume texture as 3D scalar input data
+	vr.set_gradient_texture(do_calculate_gradients ? &gradient_tex : nullptr); // precomputed gradients replace the differences otherwise taken in the shader
 	vr.set_transfer_function_texture(&transfer_function.ref_texture()); // get the texture from the transfer function color map to transform scalar volume values into RGBA colors
 	// set the volume bounding box and enable transform to automatically place and size the volume to the defined bounds
 	vr.set_bounding_box(volume_bounding_box);
@@ -317,12 +429,26 @@ void slice_renderer::create_gui()
 	add_member_control(this, "X Resolution", sample_width, "value_slider", "min=128;max=4096;step=32;");
 	add_member_control(this, "Y Resolution", sample_height, "value_slider", "min=128;max=4096;step=32;");
 	connect_copy(add_button("Apply Resolution")->click, cgv::signal::rebind(this, &slice_renderer::resize_render_target));
+	add_member_control(this, "Readback Ring Depth", readback_ring_depth, "value_slider", "min=1;max=8;step=1;");
+	add_member_control(this, "Encode Threads", encode_thread_count, "value_slider", "min=1;max=32;step=1;");
+	add_member_control(this, "Adaptive PNG Filters", adaptive_png_filters, "check");
+	add_member_control(this, "Volume PNG Tables", volume_png_tables, "check");
+#if FPNG_TRAIN_HUFFMAN_TABLES
+	add_member_control(this, "Train PNG Tables", train_png_tables, "check");
+#endif
 	connect_copy(add_button("Generate Samples")->click, cgv::signal::rebind(this, &slice_renderer::generate_samples));
+	add_decorator("Volume Storage", "heading", "level=3");
+	add_member_control(this, "Storage Mode", storage_mode, "dropdown", "enums='Native,Float32'");
+	add_member_control(this, "Generator", generator, "dropdown", "enums='Scatter,Gather'");
+	add_member_control(this, "Parallel Conversion", parallel_conversion, "check");
+	add_member_control(this, "Memory Budget (MB)", memory_budget_mb, "value_slider", "min=64;max=65536;step=64;log=true;ticks=true");
 	add_decorator("Data Exports", "heading", "level=3");
 	connect_copy(add_button("Export Transfer Function")->click, cgv::signal::rebind(this, &slice_renderer::export_transfer_function));
+	add_member_control(this, "Export Visible Bricks Only", export_visible_only, "check");
 	connect_copy(add_button("Export Volume")->click, cgv::signal::rebind(this, &slice_renderer::export_volume_data));
 	
 	
+	add_member_control(this, "Precompute Gradients", do_calculate_gradients, "check");
 	if(begin_tree_node("Volume Rendering", vstyle, true)) {
 		align("\a");
 		add_gui("vstyle", vstyle);
@@ -352,10 +478,18 @@ void slice_renderer::create_gui()
 
 	add_decorator("Transfer Function", "heading", "level=3");
 	add_member_control(this, "Preset", transfer_function_preset_idx, "dropdown", "enums='#1 (White),#2,#3 (Aneurysm),#4 (Head)'");
+	add_member_control(this, "Gradient Histogram", show_gradient_histogram, "check");
+	add_member_control(this, "Min Gradient", histogram_min_gradient, "value_slider", "min=0;max=1;step=0.01;");
+	add_member_control(this, "Max Gradient", histogram_max_gradient, "value_slider", "min=0;max=1;step=0.01;");
 
 	inline_object_gui(transfer_function_editor_ptr);
 	
 	inline_object_gui(transfer_function_legend_ptr);
+
+	add_decorator("Benchmarks", "heading", "level=3");
+	connect_copy(add_button("Benchmark Conversion")->click, cgv::signal::rebind(this, &slice_renderer::benchmark_conversion));
+	connect_copy(add_button("Benchmark Splatting")->click, cgv::signal::rebind(this, &slice_renderer::benchmark_splatting));
+	connect_copy(add_button("Benchmark PNG Encoding")->click, cgv::signal::rebind(this, &slice_renderer::benchmark_png_encoding));
 }
 
 void slice_renderer::handle_transfer_function_change() {
@@ -368,6 +502,8 @@ void slice_renderer::handle_transfer_function_change() {
 				transfer_function_legend_ptr->set_color_map(ctx, transfer_function);
 		}
 	}
+
+	classify_bricks();
 }
 
 void slice_renderer::update_bounding_box() {
@@ -463,61 +599,140 @@ void slice_renderer::load_transfer_function_preset() {
 		if(transfer_function_legend_ptr)
 			transfer_function_legend_ptr->set_color_map(*ctx_ptr, transfer_function);
 	}
+
+	classify_bricks();
 }
 
 void slice_renderer::create_volume(cgv::render::context& ctx) {
 	// destruct previous texture
 	volume_tex.destruct(ctx);
 
+	// the generated volume is stored in vol_data, so drop any previously loaded volume file
+	vox_file.close();
+	vol_cache.close();
+	vol_file_name.clear();
+	vol_native_data.clear();
+	vol_native_data.shrink_to_fit();
+	vol_data_offset = 0;
+	vol_type = cgv::type::info::TypeId::TI_FLT32;
+	vol_value_scale = 1.0f;
+	vol_value_offset = 0.0f;
+
 	// calculate voxel size
 	float voxel_size = 1.0f / vres.x();
 
 	// generate volume data
 	vol_data.clear();
-	vol_data.resize(vres[0] * vres[1] * vres[2], 0.0f);
+	vol_data.resize(static_cast<size_t>(vres[0]) * vres[1] * vres[2], 0.0f);
 
 	std::mt19937 rng(42);
-	std::uniform_real_distribution<float> distr(0.0f, 1.0f);
 
 	const vec3& a = volume_bounding_box.ref_min_pnt();
 	const vec3& b = volume_bounding_box.ref_max_pnt();
 
+	// the sphere list is drawn serially from the seeded generator, so the volume only depends on the seed
+	std::vector<sphere_splat> spheres;
+
 	// generate a single large sphere in the center of the volume
-	splat_sphere(vol_data, voxel_size, 0.5f*(a + b), 0.5f, 0.75f);
+	spheres.push_back({ 0.5f*(a + b), 0.5f, 0.75f });
 
 	// add and subtract volumes of an increasing amount of randomly placed spheres of decreasing size
-	splat_spheres(vol_data, voxel_size, rng, 5, 0.2f, 0.5f);
-	splat_spheres(vol_data, voxel_size, rng, 5, 0.2f, -0.5f);
+	splat_spheres(spheres, rng, 5, 0.2f, 0.5f);
+	splat_spheres(spheres, rng, 5, 0.2f, -0.5f);
+
+	splat_spheres(spheres, rng, 50, 0.1f, 0.25f);
+	splat_spheres(spheres, rng, 50, 0.1f, -0.25f);
 
-	splat_spheres(vol_data, voxel_size, rng, 50, 0.1f, 0.25f);
-	splat_spheres(vol_data, voxel_size, rng, 50, 0.1f, -0.25f);
+	splat_spheres(spheres, rng, 100, 0.05f, 0.1f);
+	splat_spheres(spheres, rng, 100, 0.05f, -0.1f);
 
-	splat_spheres(vol_data, voxel_size, rng, 100, 0.05f, 0.1f);
-	splat_spheres(vol_data, voxel_size, rng, 100, 0.05f, -0.1f);
+	splat_spheres(spheres, rng, 200, 0.025f, 0.1f);
+	splat_spheres(spheres, rng, 200, 0.025f, -0.1f);
 
-	splat_spheres(vol_data, voxel_size, rng, 200, 0.025f, 0.1f);
-	splat_spheres(vol_data, voxel_size, rng, 200, 0.025f, -0.1f);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	const ivec3 res = static_cast<ivec3>(vres);
+
+	if(generator == VG_SCATTER) {
+		// every thread owns whole z-slabs and adds the spheres in list order, which keeps the sum of each voxel bit-identical to a serial pass
+		const int slab_depth = 4;
+		const int num_slabs = (res.z() + slab_depth - 1) / slab_depth;
+		const size_t slice_size = static_cast<size_t>(vres[0]) * vres[1];
+
+		parallel_for_each(static_cast<size_t>(num_slabs), [&](unsigned, size_t slab) {
+			const int z_begin = static_cast<int>(slab) * slab_depth;
+			const int z_end = std::min(z_begin + slab_depth, res.z());
+			float* slab_data = vol_data.data() + slice_size * z_begin;
+
+			for(const sphere_splat& sphere : spheres)
+				splat_sphere(slab_data, ivec3(0, 0, z_begin), ivec3(res.x(), res.y(), z_end), voxel_size, sphere.pos, sphere.radius, sphere.contribution);
+
+			// make sure the volume values are in the range [0,1]
+			for(size_t i = 0; i < slice_size * (z_end - z_begin); ++i)
+				slab_data[i] = cgv::math::clamp(slab_data[i], 0.0f, 1.0f);
+		});
+	} else {
+		// bin the spheres by the bricks their voxel range overlaps, the bins keep the list order
+		const int brick_size = static_cast<int>(volume_bricks::brick_size);
+		const ivec3 brick_res((res.x() + brick_size - 1) / brick_size, (res.y() + brick_size - 1) / brick_size, (res.z() + brick_size - 1) / brick_size);
+		std::vector<std::vector<uint32_t>> bins(static_cast<size_t>(brick_res.x()) * brick_res.y() * brick_res.z());
+
+		for(size_t i = 0; i < spheres.size(); ++i) {
+			ivec3 sidx, eidx;
+			get_sphere_voxel_range(voxel_size, spheres[i].pos, spheres[i].radius, sidx, eidx);
+
+			for(int z = sidx.z() / brick_size; z <= eidx.z() / brick_size; ++z)
+				for(int y = sidx.y() / brick_size; y <= eidx.y() / brick_size; ++y)
+					for(int x = sidx.x() / brick_size; x <= eidx.x() / brick_size; ++x)
+						bins[x + brick_res.x() * (y + static_cast<size_t>(brick_res.y()) * z)].push_back(static_cast<uint32_t>(i));
+		}
+
+		// sum each brick in a cache resident buffer and write every voxel of the volume exactly once, already clamped to [0,1]
+		std::vector<std::vector<float>> brick_buffers(get_worker_count());
+
+		parallel_for_each(bins.size(), [&](unsigned thread_index, size_t brick) {
+			const ivec3 brick_idx(
+				static_cast<int>(brick % brick_res.x()),
+				static_cast<int>((brick / brick_res.x()) % brick_res.y()),
+				static_cast<int>(brick / (static_cast<size_t>(brick_res.x()) * brick_res.y()))
+			);
+			const ivec3 begin = brick_idx * brick_size;
+			const ivec3 end(std::min(begin.x() + brick_size, res.x()), std::min(begin.y() + brick_size, res.y()), std::min(begin.z() + brick_size, res.z()));
+			const ivec3 extent = end - begin;
+
+			std::vector<float>& buffer = brick_buffers[thread_index];
+			buffer.assign(static_cast<size_t>(extent.x()) * extent.y() * extent.z(), 0.0f);
+
+			for(uint32_t i : bins[brick])
+				splat_sphere(buffer.data(), begin, end, voxel_size, spheres[i].pos, spheres[i].radius, spheres[i].contribution);
+
+			const float* src = buffer.data();
+			for(int z = begin.z(); z < end.z(); ++z) {
+				for(int y = begin.y(); y < end.y(); ++y) {
+					float* dst = vol_data.data() + begin.x() + static_cast<size_t>(vres[0]) * (y + static_cast<size_t>(vres[1]) * z);
+					for(int x = 0; x < extent.x(); ++x)
+						dst[x] = cgv::math::clamp(*src++, 0.0f, 1.0f);
+				}
+			}
+		});
+	}
 
-	// make sure the volume values are in the range [0,1]
-	for(size_t i = 0; i < vol_data.size(); ++i)
-		vol_data[i] = cgv::math::clamp(vol_data[i], 0.0f, 1.0f);
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::cout << "Generated volume from " << spheres.size() << " spheres in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms (" << (generator == VG_SCATTER ? "scatter" : "gather") << ")" << std::endl;
 
 	// transfer volume data into volume texture
-	// and compute mipmaps
-	cgv::data::data_format vol_df(vres[0], vres[1], vres[2], cgv::type::info::TypeId::TI_FLT32, cgv::data::ComponentFormat::CF_R);
-	cgv::data::const_data_view vol_dv(&vol_df, vol_data.data());
-	volume_tex.create(ctx, vol_dv, 0);
+	upload_volume_texture(ctx);
 
 	// set the volume bounding box to later scale the rendering accordingly
 	volume_bounding_box.ref_min_pnt() = volume_bounding_box.ref_min_pnt();
 	volume_bounding_box.ref_max_pnt() = volume_bounding_box.ref_max_pnt();
 
-	// calculate a histogram
-	create_histogram();
+	// record the value range of every brick and the statistics of the volume
+	update_volume_statistics();
 }
 
-// splats n spheres of given radius into the volume, by adding the contribution to the covered voxel cells
-void slice_renderer::splat_spheres(std::vector<float>& vol_data, float voxel_size, std::mt19937& rng, size_t n, float radius, float contribution) {
+// draws n spheres of given radius at random positions inside the volume and appends them to the list of spheres to splat
+void slice_renderer::splat_spheres(std::vector<sphere_splat>& spheres, std::mt19937& rng, size_t n, float radius, float contribution) {
 	std::uniform_real_distribution<float> distr(0.0f, 1.0f);
 
 	const vec3& a = volume_bounding_box.ref_min_pnt();
@@ -528,58 +743,142 @@ void slice_renderer::splat_spheres(std::vector<float>& vol_data, float voxel_siz
 		pos.x() = cgv::math::lerp(a.x(), b.x(), distr(rng));
 		pos.y() = cgv::math::lerp(a.y(), b.y(), distr(rng));
 		pos.z() = cgv::math::lerp(a.z(), b.z(), distr(rng));
-		splat_sphere(vol_data, voxel_size, pos, radius, contribution);
+		spheres.push_back({ pos, radius, contribution });
 	}
 }
 
-// splats a single sphere of given radius into the volume by adding the contribution value to the voxel cells
-void slice_renderer::splat_sphere(std::vector<float>& vol_data, float voxel_size, const vec3& pos, float radius, float contribution) {
+// computes the clamped voxel index range [sidx, eidx] covered by the bounding box of a sphere
+void slice_renderer::get_sphere_voxel_range(float voxel_size, const vec3& pos, float radius, ivec3& sidx, ivec3& eidx) const {
 
 	// compute the spheres bounding box
 	box3 box(pos - radius, pos + radius);
 	box.ref_max_pnt() -= 0.005f * voxel_size;
 
 	// get voxel indices of bounding box minimum and maximum
-	ivec3 sidx((box.get_min_pnt() - volume_bounding_box.ref_min_pnt()) / voxel_size);
-	ivec3 eidx((box.get_max_pnt() - volume_bounding_box.ref_min_pnt()) / voxel_size);
+	sidx = ivec3((box.get_min_pnt() - volume_bounding_box.ref_min_pnt()) / voxel_size);
+	eidx = ivec3((box.get_max_pnt() - volume_bounding_box.ref_min_pnt()) / voxel_size);
 
 	const ivec3 res = static_cast<ivec3>(vres);
 
 	// make sure to stay inside the volume
 	sidx = cgv::math::clamp(sidx, ivec3(0), res - 1);
 	eidx = cgv::math::clamp(eidx, ivec3(0), res - 1);
+}
+
+// splats a single sphere of given radius into a block of the volume by adding the contribution value to the voxel cells, where the block
+// stores the voxels [block_begin, block_end) densely in x-fastest order
+void slice_renderer::splat_sphere(float* block, const ivec3& block_begin, const ivec3& block_end, float voxel_size, const vec3& pos, float radius, float contribution) {
+
+	ivec3 sidx, eidx;
+	get_sphere_voxel_range(voxel_size, pos, radius, sidx, eidx);
 
-	// for each covered voxel...
+	// make sure to stay inside the block
+	sidx = cgv::math::max(sidx, block_begin);
+	eidx = cgv::math::min(eidx, block_end - 1);
+
+	const ivec3 extent = block_end - block_begin;
+
+	// voxel centers lie at index * voxel_size + origin, computed per axis exactly like the former per voxel vector code
+	const vec3 origin = volume_bounding_box.ref_min_pnt() + 0.5f*voxel_size;
+	const double radius_sq = static_cast<double>(radius) * radius;
+
+	// for each covered row...
 	for(int z = sidx.z(); z <= eidx.z(); ++z) {
+		const float dz = (static_cast<float>(z) * voxel_size + origin.z()) - pos.z();
+		const float dz_sq = dz * dz;
+
 		for(int y = sidx.y(); y <= eidx.y(); ++y) {
-			for(int x = sidx.x(); x <= eidx.x(); ++x) {
-				// ...get its center location in world space
-				vec3 voxel_pos(
-					static_cast<float>(x),
-					static_cast<float>(y),
-					static_cast<float>(z)
-				);
-				voxel_pos *= voxel_size;
-				voxel_pos += volume_bounding_box.ref_min_pnt() + 0.5f*voxel_size;
-
-				// calculate the distance to the sphere center
-				float dist = length(voxel_pos - pos);
-				// add contribution to voxel if its center is inside the sphere
-				if(dist < radius) {
-					// modulate contribution by distance to sphere center
-					float dist_factor = 1.0f - (dist / radius);
-					dist_factor = sqrt(dist_factor);
-					vol_data[x + vres.x()*y + vres.x()*vres.y()*z] += contribution * dist_factor;
+			const float dy = (static_cast<float>(y) * voxel_size + origin.y()) - pos.y();
+			const float dy_sq = dy * dy;
+
+			// ...compute the x-span of voxel centers inside the sphere, padded by a voxel so that rounding never cuts off an inside voxel
+			const double span_sq = radius_sq - (static_cast<double>(dy_sq) + dz_sq);
+			if(span_sq < -1e-4 * radius_sq)
+				continue;
+
+			const double half_span = std::sqrt(std::max(span_sq, 0.0)) / voxel_size;
+			const double center_idx = (static_cast<double>(pos.x()) - origin.x()) / voxel_size;
+			const int x_begin = std::max(sidx.x(), static_cast<int>(std::floor(center_idx - half_span)) - 1);
+			const int x_end = std::min(eidx.x() + 1, static_cast<int>(std::ceil(center_idx + half_span)) + 2);
+
+			// ...and add the contribution, modulated by distance to the sphere center, to all voxels in the span whose center is inside the sphere
+			if(x_begin < x_end) {
+				float* row = block + (x_begin - block_begin.x()) + static_cast<size_t>(extent.x()) * ((y - block_begin.y()) + static_cast<size_t>(extent.y()) * (z - block_begin.z()));
+				splat_sphere_row(row, x_begin, x_end, origin.x(), voxel_size, pos.x(), dy_sq, dz_sq, radius, contribution);
+			}
+		}
+	}
+}
+
+void slice_renderer::benchmark_splatting() {
+
+	const float voxel_size = 1.0f / vres.x();
+	const size_t num_voxels = static_cast<size_t>(vres[0]) * vres[1] * vres[2];
+	const ivec3 res = static_cast<ivec3>(vres);
+	const int num_spheres = 20;
+
+	// the per voxel loop used before the row kernel existed
+	const auto splat_sphere_per_voxel = [&](std::vector<float>& data, const vec3& pos, float radius, float contribution) {
+		box3 box(pos - radius, pos + radius);
+		box.ref_max_pnt() -= 0.005f * voxel_size;
+
+		ivec3 sidx((box.get_min_pnt() - volume_bounding_box.ref_min_pnt()) / voxel_size);
+		ivec3 eidx((box.get_max_pnt() - volume_bounding_box.ref_min_pnt()) / voxel_size);
+		sidx = cgv::math::clamp(sidx, ivec3(0), res - 1);
+		eidx = cgv::math::clamp(eidx, ivec3(0), res - 1);
+
+		for(int z = sidx.z(); z <= eidx.z(); ++z) {
+			for(int y = sidx.y(); y <= eidx.y(); ++y) {
+				for(int x = sidx.x(); x <= eidx.x(); ++x) {
+					vec3 voxel_pos(static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+					voxel_pos *= voxel_size;
+					voxel_pos += volume_bounding_box.ref_min_pnt() + 0.5f*voxel_size;
+
+					float dist = length(voxel_pos - pos);
+					if(dist < radius)
+						data[x + vres.x()*y + vres.x()*vres.y()*z] += contribution * sqrt(1.0f - (dist / radius));
 				}
 			}
 		}
+	};
+
+	std::vector<float> reference(num_voxels), splatted(num_voxels);
+
+	std::cout << "Splatting benchmark (" << vres[0] << "x" << vres[1] << "x" << vres[2] << " voxels, " << num_spheres << " spheres per radius, single thread):" << std::endl;
+
+	for(float radius : { 0.025f, 0.05f, 0.1f, 0.2f, 0.5f }) {
+		std::mt19937 sphere_rng(42);
+		std::vector<sphere_splat> spheres;
+		splat_spheres(spheres, sphere_rng, num_spheres, radius, 0.1f);
+
+		const auto time_best_of_3 = [&](std::vector<float>& data, const auto& splat) {
+			double best_ms = std::numeric_limits<double>::max();
+			for(int run = 0; run < 3; ++run) {
+				std::fill(data.begin(), data.end(), 0.0f);
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				for(const sphere_splat& sphere : spheres)
+					splat(sphere);
+				std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+				best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+			}
+			return best_ms;
+		};
+
+		const double per_voxel_ms = time_best_of_3(reference, [&](const sphere_splat& sphere) {
+			splat_sphere_per_voxel(reference, sphere.pos, sphere.radius, sphere.contribution);
+		});
+		const double row_span_ms = time_best_of_3(splatted, [&](const sphere_splat& sphere) {
+			splat_sphere(splatted.data(), ivec3(0), res, voxel_size, sphere.pos, sphere.radius, sphere.contribution);
+		});
+
+		const bool identical = std::memcmp(reference.data(), splatted.data(), num_voxels * sizeof(float)) == 0;
+		std::cout << "  radius " << radius << ": per voxel " << per_voxel_ms << "ms, row span SIMD " << row_span_ms << "ms, speedup " << per_voxel_ms / row_span_ms << "x" << (identical ? "" : ", RESULTS DIFFER") << std::endl;
 	}
 }
 
 void slice_renderer::load_volume_from_file(const std::string& file_name) {
 
 	std::string header_content;
-	char* vox_content;
 
 	std::string hd_file_name = "";
 	std::string vox_file_name = "";
@@ -606,6 +905,9 @@ void slice_renderer::load_volume_from_file(const std::string& file_name) {
 
 	ivec3 resolution(-1);
 	vec3 spacing(1.0f);
+	cgv::type::info::TypeId voxel_type = cgv::type::info::TypeId::TI_UINT8;
+	bool big_endian = false;
+	size_t data_offset = 0;
 
 	std::vector<cgv::utils::line> lines;
 	cgv::utils::split_to_lines(header_content, lines);
@@ -652,6 +954,40 @@ void slice_renderer::load_volume_from_file(const std::string& file_name) {
 						break;
 				}
 			}
+		} else if(identifier == "Type") {
+			std::string str;
+			for(size_t i = 1; i < tokens.size(); ++i)
+				str += (i > 1 ? " " : "") + to_string(tokens[i]);
+			str = cgv::utils::to_lower(str);
+
+			if(str == "uchar" || str == "uint8" || str == "unsigned char" || str == "byte") {
+				voxel_type = cgv::type::info::TypeId::TI_UINT8;
+			} else if(str == "ushort" || str == "uint16" || str == "unsigned short") {
+				voxel_type = cgv::type::info::TypeId::TI_UINT16;
+			} else if(str == "float" || str == "float32") {
+				voxel_type = cgv::type::info::TypeId::TI_FLT32;
+			} else {
+				std::cout << "Error: unsupported voxel type <" + str + ">." << std::endl;
+				return;
+			}
+		} else if(identifier == "Endian") {
+			std::string str = tokens.size() > 1 ? cgv::utils::to_lower(to_string(tokens[1])) : "";
+
+			if(str == "big")
+				big_endian = true;
+			else if(str == "little")
+				big_endian = false;
+			else
+				std::cout << "Warning: unknown endianness <" + str + ">, assuming little endian." << std::endl;
+		} else if(identifier == "Offset") {
+			if(tokens.size() > 1) {
+				std::string str = to_string(tokens[1]);
+
+				char* p_end;
+				const unsigned long long num = std::strtoull(str.c_str(), &p_end, 10);
+				if(str.c_str() != p_end)
+					data_offset = static_cast<size_t>(num);
+			}
 		} else {
 			std::cout << "Warning: unknown identifier <" + identifier + ">" << std::endl;
 		}
@@ -659,6 +995,8 @@ void slice_renderer::load_volume_from_file(const std::string& file_name) {
 
 	std::cout << "[resolution] = " << resolution << std::endl;
 	std::cout << "[spacing]    = " << spacing << std::endl;
+	std::cout << "[type]       = " << get_voxel_type_name(voxel_type) << (big_endian ? " (big endian)" : "") << std::endl;
+	std::cout << "[offset]     = " << data_offset << std::endl;
 
 	if(cgv::math::min_value(resolution) < 0) {
 		std::cout << "Error: could not read valid resolution." << std::endl;
@@ -674,42 +1012,643 @@ void slice_renderer::load_volume_from_file(const std::string& file_name) {
 	if(ctx_ptr) {
 		auto& ctx = *ctx_ptr;
 
+		size_t num_voxels = static_cast<size_t>(resolution.x()) * static_cast<size_t>(resolution.y()) * static_cast<size_t>(resolution.z());
+		const size_t voxel_size = get_voxel_type_size(voxel_type);
+		const size_t num_bytes = num_voxels * voxel_size;
+
+		// map the voxel file instead of reading it, so the texture upload and histogram read directly from the page cache;
+		// the new file is checked before it replaces the current volume, which stays intact if loading fails
+		mapped_file new_vox_file;
+		if(!new_vox_file.open(vox_file_name)) {
+			std::cout << "Error: failed to read voxel file." << std::endl;
+			return;
+		}
+
+		if(new_vox_file.size() < data_offset || new_vox_file.size() - data_offset < num_bytes) {
+			std::cout << "Error: could not read the expected number " << num_voxels << " of voxels but only " << (new_vox_file.size() > data_offset ? new_vox_file.size() - data_offset : 0) / voxel_size << "." << std::endl;
+			return;
+		}
+
+		// the mapping can only be used in place if the voxels are stored in host byte order and suitably aligned
+		const uint16_t endian_probe = 1;
+		const bool host_big_endian = *reinterpret_cast<const uint8_t*>(&endian_probe) == 0;
+		const bool swap_bytes = voxel_size > 1 && big_endian != host_big_endian;
+
+		// a volume that does not fit into the memory budget is streamed by bricks, its cache is opened before the current volume is replaced as well
+		const size_t memory_budget = static_cast<size_t>(memory_budget_mb) << 20;
+		const bool out_of_core = num_bytes > memory_budget;
+		brick_cache new_cache;
+		if(out_of_core) {
+			new_vox_file.close();
+
+			const unsigned resolution_u[3] = { static_cast<unsigned>(resolution[0]), static_cast<unsigned>(resolution[1]), static_cast<unsigned>(resolution[2]) };
+			if(!new_cache.open(vox_file_name, resolution_u, voxel_size, data_offset, swap_bytes, memory_budget / 2)) {
+				std::cout << "Error: failed to open voxel file for streaming." << std::endl;
+				return;
+			}
+		}
+
+		// all checks passed, the previous mapping and cache are released when new_vox_file and new_cache go out of scope
+		vox_file.swap(new_vox_file);
+		vol_cache.swap(new_cache);
+
 		vres = resolution;
 		vspacing = spacing;
-
-		size_t num_voxels = resolution.x() * resolution.y() * resolution.z();
+		vol_file_name = file_name;
+		vol_type = voxel_type;
+		vol_data_offset = data_offset;
 
 		vol_data.clear();
-		vol_data.resize(num_voxels, 0.0f);
+		vol_data.shrink_to_fit();
+		vol_native_data.clear();
+		vol_native_data.shrink_to_fit();
+
+		if(out_of_core) {
+			// only bricks are read on demand and a downsampled proxy is rendered
+			std::cout << "Volume exceeds the memory budget of " << memory_budget_mb << "MB, streaming it through a cache of " << vol_cache.get_capacity() << " bricks" << std::endl;
+			update_value_normalization();
+			build_proxy_volume(memory_budget / 2);
+		} else if(storage_mode == VSM_FLOAT32) {
+			// widen the voxels to floats and release the mapping, vol_data now backs the volume
+			vol_data.resize(num_voxels);
+			const float scale = get_voxel_type_scale(voxel_type);
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+			decode_mapped_voxels(num_voxels, voxel_size, swap_bytes, [&](const uint8_t* bytes, size_t first, size_t count) {
+				widen_voxels(voxel_type, bytes, vol_data.data() + first, count, scale, parallel_conversion);
+			});
+
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			std::cout << "Converted " << num_voxels << " voxels to float in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms (" << (parallel_conversion ? "parallel" : "scalar") << ")" << std::endl;
+
+			vox_file.close();
+			vol_type = cgv::type::info::TypeId::TI_FLT32;
+
+			// float voxels outside [0,1] are normalized in place, like the widened integer voxels
+			update_value_normalization();
+			if(vol_value_scale != 1.0f || vol_value_offset != 0.0f) {
+				parallel_for_ranges(0, num_voxels, size_t(1) << 16, [&](unsigned, size_t first, size_t last) {
+					for(size_t i = first; i < last; ++i)
+						vol_data[i] = vol_data[i] * vol_value_scale + vol_value_offset;
+				});
+
+				vol_value_scale = 1.0f;
+				vol_value_offset = 0.0f;
+			}
+		} else if(swap_bytes || data_offset % voxel_size != 0) {
+			// keep a native copy in host byte order, converted chunk by chunk while the next chunk is prefetched
+			vol_native_data.resize(num_bytes);
 
-		std::vector<unsigned char> raw_vol_data(num_voxels, 0u);
+			decode_mapped_voxels(num_voxels, voxel_size, swap_bytes, [&](const uint8_t* bytes, size_t first, size_t count) {
+				std::memcpy(vol_native_data.data() + first * voxel_size, bytes, count * voxel_size);
+			});
 
-		FILE* fp = fopen(vox_file_name.c_str(), "rb");
-		if(fp) {
-			std::size_t nr = fread(raw_vol_data.data(), 1, num_voxels, fp);
-			if(nr != num_voxels) {
-				std::cout << "Error: could not read the expected number " << num_voxels << " of voxels but only " << nr << "." << std::endl;
-				fclose(fp);
-			}
+			vox_file.close();
+			update_value_normalization();
 		} else {
-			std::cout << "Error: failed to read voxel file." << std::endl;
+			vox_file.advise_sequential(data_offset, num_bytes);
+			update_value_normalization();
 		}
-		fclose(fp);
-
-		for(size_t i = 0; i < num_voxels; ++i)
-			vol_data[i] = static_cast<float>(raw_vol_data[i] / 255.0f);
 
 		if(volume_tex.is_created())
 			volume_tex.destruct(ctx);
 
-		cgv::data::data_format vol_df(resolution[0], resolution[1], resolution[2], cgv::type::info::TypeId::TI_FLT32, cgv::data::ComponentFormat::CF_R);
-		cgv::data::const_data_view vol_dv(&vol_df, vol_data.data());
-		volume_tex.create(ctx, vol_dv, 0);
+		upload_volume_texture(ctx);
 
 		fit_to_resolution();
 	}
 
-	create_histogram();
+	update_volume_statistics();
+}
+
+template <typename F>
+void slice_renderer::decode_mapped_voxels(size_t num_voxels, size_t voxel_size, bool swap_bytes, F&& f) {
+
+	const size_t chunk_voxels = size_t(1) << 20;
+	const size_t num_chunks = (num_voxels + chunk_voxels - 1) / chunk_voxels;
+	const uint8_t* src = vox_file.data() + vol_data_offset;
+
+	// voxels are passed on from a small per thread staging buffer if they need to be reordered or realigned
+	const bool stage = swap_bytes || reinterpret_cast<uintptr_t>(src) % voxel_size != 0;
+	std::vector<std::vector<uint8_t>> chunk_buffers(parallel_conversion ? get_worker_count() : 1);
+
+	const auto decode_chunk = [&](unsigned thread_index, size_t chunk_index) {
+		const size_t first = chunk_index * chunk_voxels;
+		const size_t count = std::min(chunk_voxels, num_voxels - first);
+		const uint8_t* chunk = src + first * voxel_size;
+
+		// let the operating system read ahead while this chunk is converted, other threads fault in their own chunks meanwhile
+		vox_file.advise_sequential(vol_data_offset + (first + count) * voxel_size, chunk_voxels * voxel_size);
+
+		if(!stage) {
+			f(chunk, first, count);
+			return;
+		}
+
+		std::vector<uint8_t>& chunk_buffer = chunk_buffers[thread_index];
+		chunk_buffer.resize(chunk_voxels * voxel_size);
+
+		if(!swap_bytes)
+			std::memcpy(chunk_buffer.data(), chunk, count * voxel_size);
+		else if(voxel_size == 2)
+			swap_bytes_16(chunk, chunk_buffer.data(), count);
+		else
+			swap_bytes_32(chunk, chunk_buffer.data(), count);
+
+		f(chunk_buffer.data(), first, count);
+	};
+
+	if(parallel_conversion) {
+		parallel_for_each(num_chunks, decode_chunk);
+	} else {
+		for(size_t chunk_index = 0; chunk_index < num_chunks; ++chunk_index)
+			decode_chunk(0u, chunk_index);
+	}
+}
+
+void slice_renderer::widen_voxels(cgv::type::info::TypeId type, const uint8_t* src, float* dst, size_t count, float scale, bool use_simd) {
+
+	switch(type) {
+	case cgv::type::info::TypeId::TI_UINT8:
+		if(use_simd) {
+			widen_uint8_to_float(src, dst, count, scale);
+		} else {
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = static_cast<float>(src[i]) * scale;
+		}
+		break;
+	case cgv::type::info::TypeId::TI_UINT16:
+		if(use_simd) {
+			widen_uint16_to_float(reinterpret_cast<const uint16_t*>(src), dst, count, scale);
+		} else {
+			for(size_t i = 0; i < count; ++i)
+				dst[i] = static_cast<float>(reinterpret_cast<const uint16_t*>(src)[i]) * scale;
+		}
+		break;
+	default:
+		std::memcpy(dst, src, count * sizeof(float));
+		break;
+	}
+}
+
+void slice_renderer::benchmark_conversion() {
+
+	// use the bytes of the current 8 bit volume if there is one, otherwise random bytes of the same size
+	const size_t num_voxels = std::max(static_cast<size_t>(vres[0]) * vres[1] * vres[2], size_t(256) * 256 * 256);
+	std::vector<uint8_t> bytes;
+	const uint8_t* src = nullptr;
+
+	if(vol_type == cgv::type::info::TypeId::TI_UINT8 && !vol_cache.is_open() && static_cast<size_t>(vres[0]) * vres[1] * vres[2] == num_voxels) {
+		src = static_cast<const uint8_t*>(get_voxel_data());
+	} else {
+		std::mt19937 bytes_rng(42);
+		bytes.resize(num_voxels);
+		for(auto& b : bytes)
+			b = static_cast<uint8_t>(bytes_rng());
+		src = bytes.data();
+	}
+
+	std::vector<float> reference(num_voxels), converted(num_voxels);
+
+	const auto time_best_of_3 = [](const auto& pass) {
+		double best_ms = std::numeric_limits<double>::max();
+		for(int run = 0; run < 3; ++run) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			pass();
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		return best_ms;
+	};
+
+	// the loop used before the conversion stage existed
+	const double scalar_ms = time_best_of_3([&]() {
+		for(size_t i = 0; i < num_voxels; ++i)
+			reference[i] = static_cast<float>(src[i] / 255.0f);
+	});
+
+	const size_t chunk_voxels = size_t(1) << 20;
+	const double parallel_ms = time_best_of_3([&]() {
+		parallel_for_each((num_voxels + chunk_voxels - 1) / chunk_voxels, [&](unsigned, size_t chunk_index) {
+			const size_t first = chunk_index * chunk_voxels;
+			widen_uint8_to_float(src + first, converted.data() + first, std::min(chunk_voxels, num_voxels - first), 1.0f / 255.0f);
+		});
+	});
+
+	float max_error = 0.0f;
+	for(size_t i = 0; i < num_voxels; ++i)
+		max_error = std::max(max_error, std::abs(reference[i] - converted[i]));
+
+	const double gigabytes = static_cast<double>(num_voxels) * (sizeof(uint8_t) + sizeof(float)) / 1e9;
+	std::cout << "Conversion benchmark (" << num_voxels << " voxels, " << get_worker_count() << " threads):" << std::endl;
+	std::cout << "  scalar loop:   " << scalar_ms << "ms, " << gigabytes / (scalar_ms / 1000.0) << " GB/s" << std::endl;
+	std::cout << "  parallel SIMD: " << parallel_ms << "ms, " << gigabytes / (parallel_ms / 1000.0) << " GB/s, max deviation " << max_error << std::endl;
+}
+
+template <typename F>
+void slice_renderer::visit_cached_bricks(size_t first_brick, size_t last_brick, F&& f) {
+
+	for(size_t brick = first_brick; brick < last_brick; ++brick) {
+		unsigned begin[3], end[3];
+		vol_cache.get_voxel_range(brick, begin, end);
+		const uint8_t* voxels = vol_cache.get_brick(brick);
+
+		switch(vol_type) {
+		case cgv::type::info::TypeId::TI_UINT8:
+			f(brick, voxels, begin, end, vol_value_scale, vol_value_offset);
+			break;
+		case cgv::type::info::TypeId::TI_UINT16:
+			f(brick, reinterpret_cast<const uint16_t*>(voxels), begin, end, vol_value_scale, vol_value_offset);
+			break;
+		default:
+			f(brick, reinterpret_cast<const float*>(voxels), begin, end, vol_value_scale, vol_value_offset);
+			break;
+		}
+	}
+}
+
+void slice_renderer::build_proxy_volume(size_t budget_bytes) {
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// pick the smallest power of two reduction that fits the budget and common 3d texture size limits, it divides the brick size
+	const size_t voxel_size = get_voxel_type_size(vol_type);
+	unsigned factor = 1;
+	for(; factor < volume_bricks::brick_size; factor *= 2) {
+		const uvec3 res((vres[0] + factor - 1) / factor, (vres[1] + factor - 1) / factor, (vres[2] + factor - 1) / factor);
+		if(max_value(res) <= 2048 && static_cast<size_t>(res[0]) * res[1] * res[2] * voxel_size <= budget_bytes)
+			break;
+	}
+
+	proxy_res = uvec3((vres[0] + factor - 1) / factor, (vres[1] + factor - 1) / factor, (vres[2] + factor - 1) / factor);
+	vol_native_data.assign(static_cast<size_t>(proxy_res[0]) * proxy_res[1] * proxy_res[2] * voxel_size, 0u);
+
+	// the same streaming pass records the value range of every brick and the statistics of the volume
+	vol_bricks.reset(vres[0], vres[1], vres[2]);
+
+	// one accumulator per voxel type, only the one of the current type is filled
+	std::tuple<
+		std::vector<volume_statistics::accumulator<uint8_t>>,
+		std::vector<volume_statistics::accumulator<uint16_t>>,
+		std::vector<volume_statistics::accumulator<float>>
+	> accumulators;
+
+	visit_cached_bricks(0, vol_cache.get_num_bricks(), [&](size_t brick, const auto* voxels, const unsigned begin[3], const unsigned end[3], float scale, float offset) {
+		using voxel_type = std::decay_t<decltype(*voxels)>;
+		voxel_type* proxy = reinterpret_cast<voxel_type*>(vol_native_data.data());
+
+		auto& type_accumulators = std::get<std::vector<volume_statistics::accumulator<voxel_type>>>(accumulators);
+		if(type_accumulators.empty())
+			type_accumulators.emplace_back(scale, offset);
+
+		const unsigned extent[3] = { end[0] - begin[0], end[1] - begin[1], end[2] - begin[2] };
+		for(unsigned z = 0; z < extent[2]; ++z)
+			for(unsigned y = 0; y < extent[1]; ++y)
+				type_accumulators[0].add_row(voxels + (static_cast<size_t>(z) * extent[1] + y) * extent[0], extent[0], begin[0], begin[1] + y, begin[2] + z);
+
+		voxel_type min_value = voxels[0];
+		voxel_type max_value = voxels[0];
+
+		// average each block of factor^3 voxels, blocks at the volume border may be partial
+		for(unsigned bz = 0; bz < extent[2]; bz += factor) {
+			for(unsigned by = 0; by < extent[1]; by += factor) {
+				for(unsigned bx = 0; bx < extent[0]; bx += factor) {
+					double sum = 0.0;
+					size_t count = 0;
+
+					for(unsigned z = bz; z < std::min(bz + factor, extent[2]); ++z) {
+						for(unsigned y = by; y < std::min(by + factor, extent[1]); ++y) {
+							const voxel_type* row = voxels + (static_cast<size_t>(z) * extent[1] + y) * extent[0];
+							for(unsigned x = bx; x < std::min(bx + factor, extent[0]); ++x) {
+								sum += static_cast<double>(row[x]);
+								min_value = std::min(min_value, row[x]);
+								max_value = std::max(max_value, row[x]);
+								++count;
+							}
+						}
+					}
+
+					const size_t px = (begin[0] + bx) / factor, py = (begin[1] + by) / factor, pz = (begin[2] + bz) / factor;
+					double average = sum / static_cast<double>(count);
+					if constexpr(std::is_integral_v<voxel_type>)
+						average = std::round(average);
+					proxy[px + proxy_res[0] * (py + static_cast<size_t>(proxy_res[1]) * pz)] = static_cast<voxel_type>(average);
+				}
+			}
+		}
+
+		vol_bricks.set_range(brick, static_cast<float>(min_value) * scale + offset, static_cast<float>(max_value) * scale + offset);
+	});
+
+	switch(vol_type) {
+	case cgv::type::info::TypeId::TI_UINT8: vol_stats.merge(std::get<0>(accumulators), vol_value_scale, vol_value_offset); break;
+	case cgv::type::info::TypeId::TI_UINT16: vol_stats.merge(std::get<1>(accumulators), vol_value_scale, vol_value_offset); break;
+	default: vol_stats.merge(std::get<2>(accumulators), vol_value_scale, vol_value_offset); break;
+	}
+
+	vol_bricks.dilate();
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::cout << "Built " << proxy_res[0] << "x" << proxy_res[1] << "x" << proxy_res[2] << " proxy (factor " << factor << ") in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+}
+
+void slice_renderer::configure_volume_texture(cgv::type::info::TypeId type) {
+
+	switch(type) {
+	case cgv::type::info::TypeId::TI_UINT8: volume_tex = cgv::render::texture("uint8[R]"); break;
+	case cgv::type::info::TypeId::TI_UINT16: volume_tex = cgv::render::texture("uint16[R]"); break;
+	default: volume_tex = cgv::render::texture("flt32[R]"); break;
+	}
+
+	volume_tex.set_min_filter(cgv::render::TF_LINEAR);
+	volume_tex.set_mag_filter(cgv::render::TF_LINEAR);
+	volume_tex.set_wrap_s(cgv::render::TW_CLAMP_TO_BORDER);
+	volume_tex.set_wrap_t(cgv::render::TW_CLAMP_TO_BORDER);
+	volume_tex.set_wrap_r(cgv::render::TW_CLAMP_TO_BORDER);
+	volume_tex.set_border_color(0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+void slice_renderer::upload_volume_texture(cgv::render::context& ctx) {
+
+	// integer textures are normalized when sampled, so the transfer function sees the same [0,1] values as with floats
+	configure_volume_texture(vol_type);
+
+	// gradients of the previous volume are outdated
+	if(gradient_tex.is_created())
+		gradient_tex.destruct(ctx);
+
+	const uvec3 tex_res = get_texture_resolution();
+
+	// float textures are not normalized when sampled, so float voxels outside [0,1] are uploaded from a normalized copy
+	const void* tex_data = get_voxel_data();
+	std::vector<float> normalized_data;
+	if(vol_type == cgv::type::info::TypeId::TI_FLT32 && (vol_value_scale != 1.0f || vol_value_offset != 0.0f)) {
+		const float* voxels = static_cast<const float*>(tex_data);
+		normalized_data.resize(static_cast<size_t>(tex_res[0]) * tex_res[1] * tex_res[2]);
+
+		parallel_for_ranges(0, normalized_data.size(), size_t(1) << 16, [&](unsigned, size_t first, size_t last) {
+			for(size_t i = first; i < last; ++i)
+				normalized_data[i] = voxels[i] * vol_value_scale + vol_value_offset;
+		});
+
+		tex_data = normalized_data.data();
+	}
+
+	cgv::data::data_format vol_df(tex_res[0], tex_res[1], tex_res[2], vol_type, cgv::data::ComponentFormat::CF_R);
+	cgv::data::const_data_view vol_dv(&vol_df, tex_data);
+
+	// rows of 8 and 16 bit volumes are tightly packed and not necessarily 4 byte aligned
+	GLint unpack_alignment;
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	volume_tex.create(ctx, vol_dv, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+}
+
+slice_renderer::uvec3 slice_renderer::get_texture_resolution() const {
+
+	// an out-of-core volume is represented by its downsampled proxy
+	return vol_cache.is_open() ? proxy_res : vres;
+}
+
+template <typename F>
+void slice_renderer::visit_gradient_rows(F&& f) const {
+
+	const uvec3 tex_res = get_texture_resolution();
+	const size_t row_size = tex_res[0];
+	const size_t slice_size = row_size * tex_res[1];
+	const size_t num_rows = static_cast<size_t>(tex_res[1]) * tex_res[2];
+
+	std::vector<std::vector<float>> row_buffers(get_worker_count());
+	std::vector<std::vector<int8_t>> texel_buffers(get_worker_count());
+
+	visit_voxels([&](const auto* voxels, size_t, float scale, float offset) {
+		using voxel_type = std::decay_t<decltype(*voxels)>;
+
+		parallel_for_ranges(0, num_rows, 64, [&](unsigned thread_index, size_t first_row, size_t last_row) {
+			std::vector<float>& buffer = row_buffers[thread_index];
+			std::vector<int8_t>& texels = texel_buffers[thread_index];
+			buffer.resize(5 * row_size);
+			texels.resize(4 * row_size);
+
+			// integer rows are widened to normalized floats with the SIMD kernels, float rows are used in place unless they need to be normalized
+			const auto get_row = [&](size_t y, size_t z, size_t slot) -> const float* {
+				const voxel_type* src = voxels + slice_size * z + row_size * y;
+				float* row = buffer.data() + slot * row_size;
+				if constexpr(std::is_same_v<voxel_type, uint8_t>) {
+					widen_uint8_to_float(src, row, row_size, scale);
+				} else if constexpr(std::is_same_v<voxel_type, uint16_t>) {
+					widen_uint16_to_float(src, row, row_size, scale);
+				} else {
+					if(scale == 1.0f && offset == 0.0f)
+						return src;
+					for(size_t x = 0; x < row_size; ++x)
+						row[x] = src[x] * scale;
+				}
+
+				if(offset != 0.0f) {
+					for(size_t x = 0; x < row_size; ++x)
+						row[x] += offset;
+				}
+				return row;
+			};
+
+			for(size_t row = first_row; row < last_row; ++row) {
+				const size_t y = row % tex_res[1];
+				const size_t z = row / tex_res[1];
+
+				// neighbors outside the volume are replaced by the row itself
+				const float* values = get_row(y, z, 0);
+				pack_central_differences(
+					values,
+					get_row(y > 0 ? y - 1 : y, z, 1),
+					get_row(y + 1 < tex_res[1] ? y + 1 : y, z, 2),
+					get_row(y, z > 0 ? z - 1 : z, 3),
+					get_row(y, z + 1 < tex_res[2] ? z + 1 : z, 4),
+					row_size,
+					texels.data()
+				);
+
+				f(thread_index, y, z, values, texels.data());
+			}
+		});
+	});
+}
+
+void slice_renderer::create_gradient_texture(cgv::render::context& ctx) {
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	const uvec3 tex_res = get_texture_resolution();
+	const size_t row_size = tex_res[0];
+	const size_t slice_size = row_size * tex_res[1];
+
+	std::vector<int8_t> gradients(slice_size * tex_res[2] * 4);
+
+	visit_gradient_rows([&](unsigned, size_t y, size_t z, const float*, const int8_t* texels) {
+		std::memcpy(gradients.data() + 4 * (slice_size * z + row_size * y), texels, 4 * row_size);
+	});
+
+	cgv::data::data_format gradient_df(tex_res[0], tex_res[1], tex_res[2], cgv::type::info::TypeId::TI_INT8, cgv::data::ComponentFormat::CF_RGBA);
+	cgv::data::const_data_view gradient_dv(&gradient_df, gradients.data());
+	gradient_tex.create(ctx, gradient_dv, 0);
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::cout << "Computed gradients of " << tex_res[0] << "x" << tex_res[1] << "x" << tex_res[2] << " voxels in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
+}
+
+void slice_renderer::create_gradient_histogram() {
+
+	const size_t num_buckets = volume_statistics::num_buckets;
+
+	// every thread fills its own tile, the tiles are summed afterwards
+	std::vector<std::vector<unsigned>> tiles(get_worker_count(), std::vector<unsigned>(num_buckets * gradient_histogram_rows, 0u));
+
+	const size_t row_size = get_texture_resolution()[0];
+
+	visit_gradient_rows([&](unsigned thread_index, size_t, size_t, const float* values, const int8_t* texels) {
+		unsigned* tile = tiles[thread_index].data();
+		for(size_t x = 0; x < row_size; ++x) {
+			// the alpha channel holds the gradient magnitude in [0,127], one histogram row per step
+			const size_t magnitude_bucket = static_cast<size_t>(std::max<int8_t>(texels[4 * x + 3], 0));
+			++tile[magnitude_bucket * num_buckets + volume_statistics::bucket_of(values[x])];
+		}
+	});
+
+	gradient_histogram.assign(num_buckets * gradient_histogram_rows, 0u);
+	for(const auto& tile : tiles)
+		for(size_t i = 0; i < tile.size(); ++i)
+			gradient_histogram[i] += tile[i];
+}
+
+void slice_renderer::update_histogram_display() {
+
+	if(!transfer_function_editor_ptr)
+		return;
+
+	if(!show_gradient_histogram || gradient_histogram.empty()) {
+		transfer_function_editor_ptr->set_histogram_data(vol_stats.get_histogram());
+		return;
+	}
+
+	// show the value distribution of the voxels inside the selected band of gradient magnitudes
+	const size_t num_buckets = volume_statistics::num_buckets;
+	const size_t first_row = static_cast<size_t>(cgv::math::clamp(histogram_min_gradient, 0.0f, 1.0f) * (gradient_histogram_rows - 1) + 0.5f);
+	const size_t last_row = static_cast<size_t>(cgv::math::clamp(histogram_max_gradient, 0.0f, 1.0f) * (gradient_histogram_rows - 1) + 0.5f);
+
+	std::vector<unsigned> histogram(num_buckets, 0u);
+	for(size_t row = first_row; row <= last_row; ++row)
+		for(size_t bucket = 0; bucket < num_buckets; ++bucket)
+			histogram[bucket] += gradient_histogram[row * num_buckets + bucket];
+
+	transfer_function_editor_ptr->set_histogram_data(histogram);
+}
+
+const void* slice_renderer::get_voxel_data() const {
+
+	if(vox_file.is_open())
+		return vox_file.data() + vol_data_offset;
+	if(!vol_native_data.empty())
+		return vol_native_data.data();
+	return vol_data.data();
+}
+
+size_t slice_renderer::get_voxel_type_size(cgv::type::info::TypeId type) {
+
+	switch(type) {
+	case cgv::type::info::TypeId::TI_UINT8: return 1;
+	case cgv::type::info::TypeId::TI_UINT16: return 2;
+	default: return 4;
+	}
+}
+
+float slice_renderer::get_voxel_type_scale(cgv::type::info::TypeId type) {
+
+	switch(type) {
+	case cgv::type::info::TypeId::TI_UINT8: return 1.0f / 255.0f;
+	case cgv::type::info::TypeId::TI_UINT16: return 1.0f / 65535.0f;
+	default: return 1.0f;
+	}
+}
+
+std::string slice_renderer::get_voxel_type_name(cgv::type::info::TypeId type) {
+
+	switch(type) {
+	case cgv::type::info::TypeId::TI_UINT8: return "uint8";
+	case cgv::type::info::TypeId::TI_UINT16: return "uint16";
+	default: return "float32";
+	}
+}
+
+template <typename F>
+void slice_renderer::visit_voxels(F&& f) const {
+
+	const size_t num_voxels = static_cast<size_t>(vres[0]) * vres[1] * vres[2];
+	const void* voxels = get_voxel_data();
+
+	switch(vol_type) {
+	case cgv::type::info::TypeId::TI_UINT8:
+		f(static_cast<const uint8_t*>(voxels), num_voxels, vol_value_scale, vol_value_offset);
+		break;
+	case cgv::type::info::TypeId::TI_UINT16:
+		f(static_cast<const uint16_t*>(voxels), num_voxels, vol_value_scale, vol_value_offset);
+		break;
+	default:
+		f(static_cast<const float*>(voxels), num_voxels, vol_value_scale, vol_value_offset);
+		break;
+	}
+}
+
+void slice_renderer::update_value_normalization() {
+
+	// integer voxels are normalized by the range of their type
+	vol_value_scale = get_voxel_type_scale(vol_type);
+	vol_value_offset = 0.0f;
+
+	if(vol_type != cgv::type::info::TypeId::TI_FLT32)
+		return;
+
+	// float voxels carry no range, so it is taken from the values; the histogram of float voxels is bucketed while it is
+	// accumulated and needs the normalization beforehand, which is why it cannot come from the statistics pass
+	float min_value = std::numeric_limits<float>::max();
+	float max_value = std::numeric_limits<float>::lowest();
+
+	if(vol_cache.is_open()) {
+		visit_cached_bricks(0, vol_cache.get_num_bricks(), [&](size_t, const auto* voxels, const unsigned begin[3], const unsigned end[3], float, float) {
+			const size_t count = static_cast<size_t>(end[0] - begin[0]) * (end[1] - begin[1]) * (end[2] - begin[2]);
+			for(size_t i = 0; i < count; ++i) {
+				min_value = std::min(min_value, static_cast<float>(voxels[i]));
+				max_value = std::max(max_value, static_cast<float>(voxels[i]));
+			}
+		});
+	} else {
+		const float* voxels = static_cast<const float*>(get_voxel_data());
+		std::vector<float> min_values(get_worker_count(), min_value);
+		std::vector<float> max_values(get_worker_count(), max_value);
+
+		parallel_for_ranges(0, static_cast<size_t>(vres[0]) * vres[1] * vres[2], size_t(1) << 16, [&](unsigned thread_index, size_t first, size_t last) {
+			float range_min = min_values[thread_index];
+			float range_max = max_values[thread_index];
+			for(size_t i = first; i < last; ++i) {
+				range_min = std::min(range_min, voxels[i]);
+				range_max = std::max(range_max, voxels[i]);
+			}
+			min_values[thread_index] = range_min;
+			max_values[thread_index] = range_max;
+		});
+
+		min_value = *std::min_element(min_values.begin(), min_values.end());
+		max_value = *std::max_element(max_values.begin(), max_values.end());
+	}
+
+	// float volumes already in [0,1] are used as they are, so the transfer function presets keep their meaning
+	if((min_value >= 0.0f && max_value <= 1.0f) || !(max_value > min_value))
+		return;
+
+	std::cout << "Normalizing float voxels from [" << min_value << "," << max_value << "] to [0,1]" << std::endl;
+	vol_value_scale = 1.0f / (max_value - min_value);
+	vol_value_offset = -min_value * vol_value_scale;
 }
 
 void slice_renderer::fit_to_resolution() {
@@ -743,19 +1682,45 @@ void slice_renderer::fit_to_resolution_and_spacing() {
 	update_bounding_box();
 }
 
-void slice_renderer::create_histogram() {
-	std::vector<unsigned> histogram(128, 0u);
+void slice_renderer::update_volume_statistics() {
 
-	for(size_t i = 0; i < vol_data.size(); ++i) {
-		size_t bucket = static_cast<size_t>(vol_data[i] * 128.0f);
-		size_t min = 0;
-		size_t max = 127;
-		bucket = cgv::math::clamp(bucket, min, max);
-		++histogram[bucket];
+	// the ranges and statistics of an out-of-core volume are recorded while its proxy is built
+	if(!vol_cache.is_open()) {
+		// a single sweep over the bricks records their value ranges together with the statistics of the volume, one accumulator per thread
+		vol_bricks.clear();
+		visit_voxels([this](const auto* voxels, size_t, float scale, float offset) {
+			using voxel_type = std::decay_t<decltype(*voxels)>;
+			std::vector<volume_statistics::accumulator<voxel_type>> accumulators(get_worker_count(), volume_statistics::accumulator<voxel_type>(scale, offset));
+
+			vol_bricks.build(voxels, vres[0], vres[1], vres[2], scale, offset, [&](unsigned thread_index, const voxel_type* row, unsigned count, unsigned x, unsigned y, unsigned z) {
+				accumulators[thread_index].add_row(row, count, x, y, z);
+			});
+
+			vol_stats.merge(accumulators, scale, offset);
+		});
 	}
 
-	if(transfer_function_editor_ptr)
-		transfer_function_editor_ptr->set_histogram_data(histogram);
+	classify_bricks();
+
+	// the 2d histogram is only computed while it is shown
+	gradient_histogram.clear();
+	if(show_gradient_histogram)
+		create_gradient_histogram();
+
+	update_histogram_display();
+}
+
+void slice_renderer::classify_bricks() {
+
+	if(vol_bricks.empty())
+		return;
+
+	// sample the opacity of the transfer function at the resolution of an 8 bit volume
+	std::vector<float> opacity_table;
+	for(const auto& color : transfer_function.interpolate(256))
+		opacity_table.push_back(color.alpha());
+
+	vol_bricks.classify(opacity_table);
 }
 
 // Uniformly sample a point on the surface of a sphere
@@ -852,6 +1817,7 @@ void slice_renderer::generate_samples()
 	if (!ctx_ptr)
 	{
 		std::cout << "No context found!" << std::endl;
+		num_failed_samples = static_cast<size_t>(sample_count);
 		return;
 	}
 
@@ -864,7 +1830,7 @@ void slice_renderer::generate_samples()
 	}
 	
 	// Create the folder again
-	std::filesystem::create_directory("./out/images");
+	std::filesystem::create_directories("./out/images");
 		
 
 	// Create the JSON data structure which stores information about the samples
@@ -892,6 +1858,68 @@ void slice_renderer::generate_samples()
 		{"frames", frames_array}
 	};
 	
+	// Frames are read back through a ring of pixel pack buffers, so that the next frame is rendered while earlier ones are still being copied
+	const unsigned frame_width = volume_frame_buffer.get_size().x();
+	const unsigned frame_height = volume_frame_buffer.get_size().y();
+	readback.init(static_cast<size_t>(readback_ring_depth), frame_width, frame_height);
+
+	// Encoding and writing happens on background threads, the queue is bounded so that frames cannot pile up in memory
+	unsigned num_encode_threads = static_cast<unsigned>(std::max(1, encode_thread_count));
+	uint32_t png_flags = get_png_flags();
+#if FPNG_TRAIN_HUFFMAN_TABLES
+	// Training counts the symbols of the Huffman tables fpng builds for each sample, which only the slower encoder does
+	if(train_png_tables) {
+		std::memset(fpng::g_huff_counts, 0, sizeof(fpng::g_huff_counts));
+		num_encode_threads = 1;
+		png_flags = (png_flags & ~static_cast<uint32_t>(fpng::FPNG_ENCODE_VOLUME_TABLES)) | fpng::FPNG_ENCODE_SLOWER;
+	}
+#endif
+	const size_t queue_capacity = 2 * static_cast<size_t>(num_encode_threads);
+	// Cores not taken by the encoding threads compress strips of the same frame
+	const unsigned strip_threads = std::max(1u, get_worker_count() / num_encode_threads);
+	sample_writer.start(num_encode_threads, queue_capacity, [strip_threads, png_flags](const std::string& filename, const uint8_t* data, unsigned width, unsigned height, fpng::fpng_encoder& encoder) {
+		return write_png(filename, data, width, height, encoder, strip_threads, png_flags);
+	});
+
+	// Enough frame buffers for a full queue, one frame per encoding thread and the one being copied, so no buffer is allocated per frame
+	const size_t frame_bytes = static_cast<size_t>(frame_width) * frame_height * 4;
+	sample_frames.init(frame_bytes, queue_capacity + num_encode_threads + 1, frame_bytes >= (size_t(2) << 20));
+
+	// Time spent in each stage, summed over all samples
+	double render_ms = 0.0;
+	double issue_ms = 0.0;
+	double wait_ms = 0.0;
+	double handoff_ms = 0.0;
+	const auto elapsed_ms = [](std::chrono::steady_clock::time_point since) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+	};
+	const std::chrono::steady_clock::time_point generation_start = std::chrono::steady_clock::now();
+
+	// Wait for the oldest frame in the ring and hand it over to the encoding threads
+	const auto write_oldest_frame = [&]()
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		size_t frame = 0;
+		const uint8_t* pixels = readback.map_oldest(frame);
+		wait_ms += elapsed_ms(start);
+
+		start = std::chrono::steady_clock::now();
+		if (pixels)
+		{
+			// The mapping is only valid on this thread, so the frame is copied into a pooled buffer for the workers
+			frame_pool::frame frame_pixels = sample_frames.acquire();
+			std::memcpy(frame_pixels.data(), pixels, frame_bytes);
+			readback.unmap_oldest();
+			sample_writer.push(get_sample_file_name(frame), std::move(frame_pixels), frame_width, frame_height);
+		}
+		else
+		{
+			std::cerr << "Failed to map frame " << frame << std::endl;
+			readback.unmap_oldest();
+		}
+		handoff_ms += elapsed_ms(start);
+	};
+
 	// Generate the samples
 	for (size_t i = 0; i < sample_count; ++i)
 	{
@@ -907,7 +1935,9 @@ void slice_renderer::generate_samples()
 		view_ptr->set_view_up_dir(up_dir);
 
 		// Cause a redraw
+		std::chrono::steady_clock::time_point render_start = std::chrono::steady_clock::now();
 		ctx_ptr->force_redraw();
+		render_ms += elapsed_ms(render_start);
 
 		// Center and zoom the view
 
@@ -927,8 +1957,18 @@ void slice_renderer::generate_samples()
 			view_ptr->pan(dist(rng) - 0.5, dist(rng) - 0.5);
 		}
 
-		// Save the image to the output directory
-		const std::string filename = dump_image_to_path("./out/images/generation.png");
+		// Make room in the ring by writing the oldest frame, whose copy overlapped with rendering this one
+		if (readback.full())
+			write_oldest_frame();
+
+		// Start copying the image, it is written to the output directory once it leaves the ring
+		std::chrono::steady_clock::time_point issue_start = std::chrono::steady_clock::now();
+		volume_frame_buffer.enable_attachment(*ctx_ptr, "COLOR", 0);
+		readback.issue(i);
+		volume_frame_buffer.disable_attachment(*ctx_ptr, "COLOR");
+		issue_ms += elapsed_ms(issue_start);
+
+		const std::string filename = get_sample_file_name(i);
 
 		// Remove the out directory from the path
 		const std::string file_path = filename.substr(5);
@@ -965,6 +2005,37 @@ void slice_renderer::generate_samples()
 		};
 	}
 
+	// Write the frames still in the ring
+	while (!readback.empty())
+		write_oldest_frame();
+	readback.destruct();
+
+	// Wait for the encoding threads to write the remaining frames
+	const std::chrono::steady_clock::time_point drain_start = std::chrono::steady_clock::now();
+	num_failed_samples = sample_writer.finish();
+	const double drain_ms = elapsed_ms(drain_start);
+	if (num_failed_samples > 0)
+		std::cerr << "Failed to write " << num_failed_samples << " samples" << std::endl;
+
+#if FPNG_TRAIN_HUFFMAN_TABLES
+	// The tables replace g_dyn_huff_4_volume and its codes in fpng.cpp
+	if(train_png_tables) {
+		std::string table_source;
+		if(fpng::create_huffman_table_source(fpng::g_huff_counts, 4, "4_volume", table_source)) {
+			std::ofstream table_file("./out/fpng_huff_4_volume.inl");
+			table_file << table_source;
+			std::cout << "Wrote Huffman tables trained on " << sample_count << " samples to ./out/fpng_huff_4_volume.inl" << std::endl;
+		}
+		else {
+			std::cerr << "Failed to create the Huffman tables" << std::endl;
+		}
+	}
+#endif
+
+	const double total_ms = elapsed_ms(generation_start);
+	std::cout << "Generated " << sample_count << " samples in " << total_ms << "ms with a readback ring of depth " << readback_ring_depth << ", " << num_encode_threads << " encode threads and " << sample_frames.get_num_allocated() << " frame buffers" << std::endl;
+	std::cout << "  render: " << render_ms << "ms, readback issue: " << issue_ms << "ms, readback wait: " << wait_ms << "ms, hand-off: " << handoff_ms << "ms (stalled on a full queue: " << sample_writer.get_stall_ms() << "ms), final drain: " << drain_ms << "ms" << std::endl;
+
 	ctx_ptr->set_gamma(old_gamma);
 
 	// Make sure frames_array is in the json data structure
@@ -977,6 +2048,55 @@ void slice_renderer::generate_samples()
 	file << sample_info.dump(2);
 }
 
+void slice_renderer::run_batch(double, double)
+{
+	std::cout << "Running batch ..." << std::endl;
+
+	if (!batch_volume_file.empty())
+	{
+		load_volume_from_file(batch_volume_file);
+
+		if (vol_file_name != batch_volume_file)
+		{
+			std::cerr << "Batch failed: could not load volume " << batch_volume_file << std::endl;
+			std::exit(2);
+		}
+	}
+
+	if (batch_preset >= 0)
+	{
+		transfer_function_preset_idx = static_cast<cgv::type::DummyEnum>(batch_preset);
+		load_transfer_function_preset();
+	}
+
+	if (batch_seed >= 0)
+		rng.seed(static_cast<std::mt19937::result_type>(batch_seed));
+
+	resize_render_target();
+
+	// Remove the results of earlier runs so that only this batch is checked
+	std::filesystem::create_directories("./out");
+	std::filesystem::remove("./out/transforms.json");
+
+	generate_samples();
+
+	// The batch succeeded if every sample was written together with the transforms, a failed write may have left a file behind
+	size_t num_images = 0;
+	if (std::filesystem::exists("./out/images"))
+	{
+		for (const auto& entry : std::filesystem::directory_iterator("./out/images"))
+		{
+			if (entry.path().extension() == ".png")
+				++num_images;
+		}
+	}
+
+	const bool success = std::filesystem::exists("./out/transforms.json") && num_images == static_cast<size_t>(sample_count) && num_failed_samples == 0;
+	std::cout << "Batch " << (success ? "finished" : "failed") << ": " << num_images << " of " << sample_count << " samples written, " << num_failed_samples << " failed" << std::endl;
+
+	std::exit(success ? 0 : 1);
+}
+
 void slice_renderer::export_transfer_function()
 {
 	if(auto ctx_ptr = get_context())
@@ -989,13 +2109,13 @@ void slice_renderer::export_transfer_function()
 		const int width = texture_reference.get_width();
 		
 		// Create a vector to store the texture data
-		GLubyte* texture_data = new GLubyte[width * 4];
+		std::vector<GLubyte> texture_data(static_cast<size_t>(width) * 4);
 
 		// Activate the texture unit
 		texture_reference.enable(*ctx_ptr);
 
 		// Get the texture data
-		glGetTexImage(GL_TEXTURE_1D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture_data);
+		glGetTexImage(GL_TEXTURE_1D, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture_data.data());
 
 		// Get last error
 		const auto error = glGetError();
@@ -1014,7 +2134,7 @@ void slice_renderer::export_transfer_function()
 		std::vector<uint8_t> data_buffer;
 
 		// Use fpng to write the data into the buffer
-		fpng::fpng_encode_image_to_memory( texture_data, width, 1, 4, data_buffer);
+		fpng::fpng_encode_image_to_memory(texture_data.data(), width, 1, 4, data_buffer);
 
 		// Write the buffer to the file using a fstream
 		std::ofstream file("./out/transfer_function.png", std::ios::out | std::ios::binary);
@@ -1033,19 +2153,80 @@ void slice_renderer::export_volume_data()
 {
 	if(auto ctx_ptr = get_context())
 	{
-		// Create a vector<char> representing the volume by converting the current volume to a 8 bit unsigned integer
-		std::vector<uint8_t> volume_data(vres[0] * vres[1] * vres[2]);
+		const size_t num_voxels = static_cast<size_t>(vres[0]) * vres[1] * vres[2];
+
+		std::ofstream file("./out/volume_data.vox", std::ios::binary | std::ios::out); 
+
+		const bool skip_invisible = export_visible_only && !vol_bricks.empty();
 
-		// Iterate the old floating point based volume and store the values in the new vector
-		for (size_t i = 0; i < volume_data.size(); ++i)
+		if (vol_cache.is_open())
 		{
-			volume_data[i] = static_cast<uint8_t>(255.0f * vol_data[i]);
+			// An out-of-core volume is converted one layer of bricks at a time, so only a slab of brick_size slices is held in memory
+			const unsigned* brick_res = vol_cache.get_brick_resolution();
+			const size_t bricks_per_layer = static_cast<size_t>(brick_res[0]) * brick_res[1];
+			const size_t slice_size = static_cast<size_t>(vres[0]) * vres[1];
+			std::vector<uint8_t> slab_data;
+
+			for (size_t layer = 0; layer < brick_res[2]; ++layer)
+			{
+				const unsigned slab_begin = static_cast<unsigned>(layer * volume_bricks::brick_size);
+				const unsigned slab_depth = std::min(slab_begin + volume_bricks::brick_size, vres[2]) - slab_begin;
+				slab_data.assign(slice_size * slab_depth, 0u);
+
+				visit_cached_bricks(layer * bricks_per_layer, (layer + 1) * bricks_per_layer, [&](size_t brick, const auto* voxels, const unsigned begin[3], const unsigned end[3], float scale, float offset) {
+					// Bricks the transfer function maps to zero opacity stay zero
+					if (skip_invisible && !vol_bricks.is_visible(brick))
+						return;
+
+					for (unsigned z = begin[2]; z < end[2]; ++z)
+					{
+						for (unsigned y = begin[1]; y < end[1]; ++y)
+						{
+							uint8_t* dst = slab_data.data() + slice_size * (z - slab_begin) + static_cast<size_t>(vres[0]) * y + begin[0];
+							for (unsigned x = begin[0]; x < end[0]; ++x, ++voxels)
+								dst[x - begin[0]] = static_cast<uint8_t>(255.0f * cgv::math::clamp(static_cast<float>(*voxels) * scale + offset, 0.0f, 1.0f));
+						}
+					}
+				});
+
+				file.write(reinterpret_cast<char*>(slab_data.data()), slab_data.size());
+			}
 		}
+		else if (vol_type == cgv::type::info::TypeId::TI_UINT8 && !skip_invisible)
+		{
+			// A loaded 8 bit volume is already in the exported format, so write the stored bytes as they are
+			file.write(static_cast<const char*>(get_voxel_data()), num_voxels);
+		}
+		else
+		{
+			// Create a vector<char> representing the volume by converting the current volume to a 8 bit unsigned integer
+			std::vector<uint8_t> volume_data(num_voxels, 0u);
+
+			// Iterate the stored volume, normalize it and store the values in the new vector
+			visit_voxels([&](const auto* voxels, size_t count, float scale, float offset) {
+				const auto convert_range = [&](size_t first, size_t range_count) {
+					for (size_t i = first; i < first + range_count; ++i)
+					{
+						volume_data[i] = static_cast<uint8_t>(255.0f * cgv::math::clamp(static_cast<float>(voxels[i]) * scale + offset, 0.0f, 1.0f));
+					}
+				};
+
+				if (!skip_invisible)
+				{
+					convert_range(0, count);
+					return;
+				}
 
-		// Write this vector to a file
-		std::ofstream file("./out/volume_data.vox", std::ios::binary | std::ios::out); 
+				// Bricks the transfer function maps to zero opacity are neither read nor converted and stay zero
+				for (size_t brick = 0; brick < vol_bricks.get_num_bricks(); ++brick)
+				{
+					if (vol_bricks.is_visible(brick))
+						vol_bricks.for_each_row(brick, convert_range);
+				}
+			});
 
-		file.write(reinterpret_cast<char*>(volume_data.data()), volume_data.size());
+			file.write(reinterpret_cast<char*>(volume_data.data()), volume_data.size());
+		}
 
 		file.close();
 
@@ -1119,6 +2300,143 @@ void slice_renderer::save_buffer_to_file(cgv::render::context& ctx)
 	std::cout << "Screenshot " << filename << " generated in " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << "ms" << std::endl;
 }
 
+std::string slice_renderer::get_sample_file_name(size_t index)
+{
+	// The names dump_image_to_path picks for consecutive images in an empty directory
+	if (index == 0)
+		return "./out/images/generation.png";
+	return "./out/images/generation_" + std::to_string(index - 1) + ".png";
+}
+
+bool slice_renderer::write_png(const std::string& filename, const uint8_t* data, unsigned width, unsigned height, fpng::fpng_encoder& encoder, unsigned num_threads, uint32_t flags)
+{
+	// OpenGL returns the bottom row first, so let fpng walk the rows backwards from the last one instead of flipping the image
+	const int64_t row_bytes = static_cast<int64_t>(width) * 4;
+	const uint8_t* top_row = data + (height > 0 ? height - 1 : 0) * row_bytes;
+
+	// Use fpng to encode the data, the encoder keeps its buffers for the next image
+	if (!encoder.encode_image(top_row, width, height, 4, -row_bytes, flags, num_threads))
+		return false;
+
+	// Write the encoded image to the file using a fstream
+	std::ofstream file(filename, std::ios::out | std::ios::binary);
+	file.write(reinterpret_cast<const char*>(encoder.get_png_data()), encoder.get_png_size());
+	file.close();
+	if (!file.fail())
+		return true;
+
+	// Don't leave a truncated png behind after a failed or short write, e.g. on a full disk
+	std::error_code error;
+	std::filesystem::remove(filename, error);
+	return false;
+}
+
+uint32_t slice_renderer::get_png_flags() const
+{
+	uint32_t flags = 0;
+	if (adaptive_png_filters)
+		flags |= fpng::FPNG_ENCODE_ADAPTIVE_FILTERS;
+	if (volume_png_tables)
+		flags |= fpng::FPNG_ENCODE_VOLUME_TABLES;
+	return flags;
+}
+
+void slice_renderer::benchmark_png_encoding()
+{
+	auto ctx_ptr = get_context();
+	if (!ctx_ptr)
+		return;
+
+	// Read back the current frame like a screenshot
+	volume_frame_buffer.enable_attachment(*ctx_ptr, "COLOR", 0);
+	const unsigned width = volume_frame_buffer.get_size().x();
+	const unsigned height = volume_frame_buffer.get_size().y();
+	std::vector<uint8_t> data(static_cast<size_t>(width) * height * 4);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+	volume_frame_buffer.disable_attachment(*ctx_ptr, "COLOR");
+	if (data.empty())
+		return;
+
+	const auto time_best_of_3 = [](const auto& pass) {
+		double best_ms = std::numeric_limits<double>::max();
+		for(int run = 0; run < 3; ++run) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			pass();
+			std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+			best_ms = std::min(best_ms, std::chrono::duration<double, std::milli>(end - start).count());
+		}
+		return best_ms;
+	};
+
+	const char* level_names[] = { "scalar", "SSE4.1", "AVX2" };
+	const double megabytes = static_cast<double>(data.size()) / 1e6;
+	const int64_t row_bytes = static_cast<int64_t>(width) * 4;
+	const uint32_t best_level = fpng::fpng_get_simd_level();
+	std::vector<uint8_t> encoded;
+
+	std::cout << "PNG encoding benchmark (" << width << "x" << height << " pixels, single thread):" << std::endl;
+	for(uint32_t level = fpng::FPNG_SIMD_SCALAR; level <= best_level; ++level) {
+		fpng::fpng_set_simd_level(level);
+
+		uint32_t checksum = 0;
+		const double crc_ms = time_best_of_3([&]() { checksum ^= fpng::fpng_crc32(data.data(), data.size()); });
+		const double adler_ms = time_best_of_3([&]() { checksum ^= fpng::fpng_adler32(data.data(), data.size()); });
+		const double encode_ms = time_best_of_3([&]() {
+			fpng::fpng_encode_image_to_memory(data.data() + (height > 0 ? height - 1 : 0) * row_bytes, width, height, 4, -row_bytes, encoded);
+		});
+
+		std::cout << "  " << level_names[level] << ": crc32 " << megabytes / (crc_ms / 1000.0) << " MB/s, adler32 " << megabytes / (adler_ms / 1000.0)
+			<< " MB/s, encode " << megabytes / (encode_ms / 1000.0) << " MB/s (" << encoded.size() << " bytes, checksum " << checksum << ")" << std::endl;
+	}
+	fpng::fpng_set_simd_level(best_level);
+
+	// Scale the frame to each size, then encode it like a sequence of frames once with the stateless function and once with a reused encoder
+	fpng::fpng_encoder encoder;
+	std::cout << "PNG encoder reuse benchmark (single thread):" << std::endl;
+	for(unsigned size : { 512u, 1024u, 4096u }) {
+		std::vector<uint8_t> scaled(static_cast<size_t>(size) * size * 4);
+		for(unsigned y = 0; y < size; ++y)
+			for(unsigned x = 0; x < size; ++x)
+				std::memcpy(&scaled[(static_cast<size_t>(y) * size + x) * 4], &data[(static_cast<size_t>(y) * height / size * width + static_cast<size_t>(x) * width / size) * 4], 4);
+
+		const int frames = size >= 4096 ? 4 : 16;
+		const double stateless_ms = time_best_of_3([&]() {
+			for(int frame = 0; frame < frames; ++frame)
+				fpng::fpng_encode_image_to_memory(scaled.data(), size, size, 4, encoded);
+		}) / frames;
+		const double reused_ms = time_best_of_3([&]() {
+			for(int frame = 0; frame < frames; ++frame)
+				encoder.encode_image(scaled.data(), size, size, 4, static_cast<int64_t>(size) * 4);
+		}) / frames;
+
+		const double scaled_megabytes = static_cast<double>(scaled.size()) / 1e6;
+		std::cout << "  " << size << "x" << size << ": stateless " << stateless_ms << "ms (" << scaled_megabytes / (stateless_ms / 1000.0) << " MB/s), reused encoder "
+			<< reused_ms << "ms (" << scaled_megabytes / (reused_ms / 1000.0) << " MB/s)" << std::endl;
+	}
+
+	// Compare the size and speed of the per row filter choice against always using Up, and of the Huffman tables trained on volume renders
+	// against the photo tables and the tables the slower encoder builds per image, on the full frame
+	const std::pair<const char*, uint32_t> configs[] = {
+		{ "up only, photo tables", 0u },
+		{ "adaptive, photo tables", fpng::FPNG_ENCODE_ADAPTIVE_FILTERS },
+		{ "adaptive, volume tables", fpng::FPNG_ENCODE_ADAPTIVE_FILTERS | fpng::FPNG_ENCODE_VOLUME_TABLES },
+		{ "adaptive, slower", fpng::FPNG_ENCODE_ADAPTIVE_FILTERS | fpng::FPNG_ENCODE_SLOWER }
+	};
+	std::cout << "PNG filter and table benchmark (single thread):" << std::endl;
+	for(const auto& [name, flags] : configs) {
+		const double encode_ms = time_best_of_3([&]() {
+			encoder.encode_image(data.data() + (height > 0 ? height - 1 : 0) * row_bytes, width, height, 4, -row_bytes, flags);
+		});
+		std::vector<uint8_t> decoded;
+		uint32_t decoded_width, decoded_height, decoded_channels;
+		const double decode_ms = time_best_of_3([&]() {
+			fpng::fpng_decode_memory(encoder.get_png_data(), static_cast<uint32_t>(encoder.get_png_size()), decoded, decoded_width, decoded_height, decoded_channels, 4);
+		});
+		std::cout << "  " << name << ": " << encoder.get_png_size() << " bytes, encode " << encode_ms << "ms (" << megabytes / (encode_ms / 1000.0)
+			<< " MB/s), decode " << decode_ms << "ms (" << megabytes / (decode_ms / 1000.0) << " MB/s)" << std::endl;
+	}
+}
+
 const std::string slice_renderer::dump_image_to_path(const std::string& file_path)
 {
 	if(auto ctx_ptr = get_context())
@@ -1154,42 +2472,17 @@ const std::string slice_renderer::dump_image_to_path(const std::string& file_pat
 		// We have the image we want in a buffer, and in that buffer in a texture, so enable that texture
 		volume_frame_buffer.enable_attachment(*ctx_ptr, "COLOR", 0);
 
-		// Next create a GLubyte array to store the data
-		GLubyte* data = new GLubyte[volume_frame_buffer.get_size().x() * volume_frame_buffer.get_size().y() * 4];
-
-		// Read the data from the texture into the array
-		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		// Read the data from the texture into a buffer
+		const unsigned width = volume_frame_buffer.get_size().x();
+		const unsigned height = volume_frame_buffer.get_size().y();
+		std::vector<uint8_t> data(static_cast<size_t>(width) * height * 4);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
 
 		// Disable the attachment
 		volume_frame_buffer.disable_attachment(*ctx_ptr, "COLOR");
 
-		// Loop through the data and flip the image vertically
-		for (int i = 0; i < volume_frame_buffer.get_size().y() / 2; ++i)
-		{
-			for (int j = 0; j < volume_frame_buffer.get_size().x(); ++j)
-			{
-				for (int k = 0; k < 4; ++k)
-				{
-					std::swap(data[i * volume_frame_buffer.get_size().x() * 4 + j * 4 + k], data[(volume_frame_buffer.get_size().y() - i - 1) * volume_frame_buffer.get_size().x() * 4 + j * 4 + k]);
-				}
-			}
-		}
-
-		
-		// Create a buffer to store the data
-		std::vector<uint8_t> data_buffer;
-
-		// Use fpng to write the data into the buffer
-		fpng::fpng_encode_image_to_memory( data, volume_frame_buffer.get_size().x(), volume_frame_buffer.get_size().y(), 4, data_buffer);
-
-		// Write the buffer to the file using a fstream
-		std::ofstream file(filename, std::ios::out | std::ios::binary);
-
-		// Write the data to the file
-		file.write(reinterpret_cast<char*>(data_buffer.data()), data_buffer.size());
-
-		// Close the file
-		file.close();
+		fpng::fpng_encoder encoder;
+		write_png(filename, data.data(), width, height, encoder, get_worker_count(), get_png_flags());
 		
 		// Get the time it took to generate the image
 		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
@@ -5,6 +5,7 @@
 #include <cgv/base/node.h>
 #include <cgv/gui/event_handler.h>
 #include <cgv/gui/provider.h>
+#include <cgv/gui/trigger.h>
 #include <cgv/render/drawable.h>
 #include <cgv/render/render_types.h>
 #include <cgv_gl/volume_renderer.h>
@@ -15,10 +16,32 @@
 #include <cgv_app/color_map_legend.h>
 #include <cgv/render/managed_frame_buffer.h>
 
+#include "brick_cache.h"
+#include "fpng.h"
+#include "frame_pool.h"
+#include "frame_writer.h"
+#include "mapped_file.h"
+#include "readback_ring.h"
+#include "volume_bricks.h"
+#include "volume_statistics.h"
+
 class slice_renderer :
 	public cgv::app::application_plugin // inherit from application plugin to enable overlay support
 {
+public:
+	/// how voxel values are stored in host memory and in the volume texture
+	enum volume_storage_mode {
+		VSM_NATIVE,	///< keep the voxel type of the source, integer voxels are sampled normalized to [0,1]
+		VSM_FLOAT32	///< widen every voxel to a 32 bit float
+	};
+	/// how the default volume is generated from its spheres, both produce bit-identical volumes
+	enum volume_generator {
+		VG_SCATTER,	///< splat every sphere into the slabs of the volume it covers
+		VG_GATHER	///< bin the spheres by brick and sum each brick once from the spheres overlapping it
+	};
+
 private:
+	/// whether gradients of the volume are precomputed into gradient_tex and used by the volume renderer
 	bool do_calculate_gradients;
 
 protected:
@@ -48,6 +71,40 @@ protected:
 	std::mt19937 rng;
 	std::uniform_real_distribution<float> dist;
 
+	/// number of frames that can be in flight between rendering and writing during sample generation
+	int readback_ring_depth;
+	/// pixel pack buffers used to read back the generated samples asynchronously
+	readback_ring readback;
+	/// number of threads encoding and writing generated samples in the background
+	int encode_thread_count;
+	/// whether samples and screenshots are written with a Sub, Up, Average or Paeth filter chosen per row instead of always Up
+	bool adaptive_png_filters;
+	/// whether samples and screenshots are compressed with fpng's Huffman tables trained on volume renders instead of its tables trained on photos
+	bool volume_png_tables;
+#if FPNG_TRAIN_HUFFMAN_TABLES
+	/// whether generating samples collects the Huffman symbol counts of the samples and writes tables trained on them to ./out/fpng_huff_4_volume.inl,
+	/// the samples are then compressed with FPNG_ENCODE_SLOWER on a single encoding thread, as fpng collects the counts without synchronization
+	bool train_png_tables;
+#endif
+	/// buffers holding generated samples between readback and encoding, declared before the writer so they outlive its queue
+	frame_pool sample_frames;
+	/// hands generated samples from the render thread over to the encoding threads
+	frame_writer sample_writer;
+
+	// Batch mode, configured through reflection, e.g. from a config file passed on the command line
+	/// whether to generate samples right after startup and exit with a status code afterwards
+	bool batch_mode;
+	/// volume file loaded in batch mode, the generated volume is used if empty
+	std::string batch_volume_file;
+	/// transfer function preset applied in batch mode, negative to keep the default
+	int batch_preset;
+	/// seed of the sample generator in batch mode, negative for a time based seed
+	int batch_seed;
+	/// fires once the viewer is running to start the batch outside of the render pass
+	cgv::gui::trigger batch_trigger;
+	/// number of samples the last call of generate_samples failed to write
+	size_t num_failed_samples;
+
 	// Information needed to store the next screenshot to disk
 	bool store_next_screenshot;
 	std::string screenshot_filename;
@@ -59,8 +116,50 @@ protected:
 
 	// Volume data
 	std::vector<float> vol_data;
+	/// memory mapping of the loaded .vox file, which backs the volume data instead of vol_data while it is open
+	mapped_file vox_file;
+	/// byte offset of the first voxel inside the mapped file
+	size_t vol_data_offset;
+	/// voxels in their native type and host byte order, used when the mapped file cannot be used in place
+	std::vector<uint8_t> vol_native_data;
+	/// file name of the loaded volume, used to reload it when the storage mode changes
+	std::string vol_file_name;
+	/// type of the voxels backing the current volume
+	cgv::type::info::TypeId vol_type;
+	/// normalization of the stored voxel values to the [0,1] range of the transfer function as value * vol_value_scale + vol_value_offset
+	float vol_value_scale;
+	float vol_value_offset;
+	/// storage mode used for loaded volumes
+	volume_storage_mode storage_mode;
+	/// generator used for the default volume
+	volume_generator generator;
+	/// whether loaded volumes are decoded on all cores with the SIMD kernels instead of a single scalar loop
+	bool parallel_conversion;
+	/// per brick value ranges of the current volume, used to skip uniform bricks and bricks invisible under the transfer function
+	volume_bricks vol_bricks;
+	/// histogram, value range, mean and non-empty bounding box of the current volume
+	volume_statistics vol_stats;
+	/// number of gradient magnitude rows of the 2d histogram, matching the 7 bit magnitudes of the packed gradients
+	static const unsigned gradient_histogram_rows = 128;
+	/// 2d histogram of value buckets (fastest) by gradient magnitude rows, empty unless it is shown
+	std::vector<unsigned> gradient_histogram;
+	/// whether the editor shows the value histogram of the voxels in a band of gradient magnitudes instead of all voxels
+	bool show_gradient_histogram;
+	/// band of gradient magnitudes, relative to the largest possible magnitude, whose voxels are shown in the editor histogram
+	float histogram_min_gradient;
+	float histogram_max_gradient;
+	/// whether exports write zero for bricks that the transfer function maps to zero opacity instead of reading them
+	bool export_visible_only;
+	/// volumes larger than this many megabytes are streamed from disk by bricks and rendered from a downsampled proxy
+	int memory_budget_mb;
+	/// on-demand brick access of a volume exceeding the memory budget, open while such a volume is loaded
+	brick_cache vol_cache;
+	/// resolution of the proxy stored in vol_native_data while vol_cache is open
+	uvec3 proxy_res;
 	box3 volume_bounding_box;
 	cgv::render::texture volume_tex;
+	/// precomputed gradients of the volume texture, signed normalized direction in RGB and magnitude in A; created on demand and dropped with the volume
+	cgv::render::texture gradient_tex;
 	
 	
 	// Render members
@@ -82,29 +181,97 @@ protected:
 
 	void load_transfer_function_preset();
 
+	/// sphere added to the generated volume
+	struct sphere_splat {
+		vec3 pos;
+		float radius;
+		float contribution;
+	};
+
 	void create_volume(cgv::render::context& ctx);
-	void splat_spheres(std::vector<float>& vol_data, float voxel_size, std::mt19937& rng, size_t n, float radius, float contribution);
-	void splat_sphere(std::vector<float>& vol_data, float voxel_size, const vec3& pos, float radius, float contribution);
+	void splat_spheres(std::vector<sphere_splat>& spheres, std::mt19937& rng, size_t n, float radius, float contribution);
+	void get_sphere_voxel_range(float voxel_size, const vec3& pos, float radius, ivec3& sidx, ivec3& eidx) const;
+	void splat_sphere(float* block, const ivec3& block_begin, const ivec3& block_end, float voxel_size, const vec3& pos, float radius, float contribution);
+	/// time the row span splatting kernel against the former per voxel loop for a range of sphere radii and print the results
+	void benchmark_splatting();
 
 	void load_volume_from_file(const std::string& file_name);
 
+	/// recreate the volume texture object with a format matching the given voxel type
+	void configure_volume_texture(cgv::type::info::TypeId type);
+	/// upload the current voxel data into the volume texture
+	void upload_volume_texture(cgv::render::context& ctx);
+	/// resolution of the volume texture, which is the proxy resolution for out-of-core volumes
+	uvec3 get_texture_resolution() const;
+	/// call f(thread_index, y, z, const float* values, const int8_t* texels) on all cores for every row of the volume texture
+	/// with its normalized values and its gradients packed like in gradient_tex
+	template <typename F>
+	void visit_gradient_rows(F&& f) const;
+	/// compute central difference gradients of the volume texture on all cores and upload them into gradient_tex
+	void create_gradient_texture(cgv::render::context& ctx);
+	/// compute the 2d value / gradient magnitude histogram of the volume texture with one tile per thread
+	void create_gradient_histogram();
+	/// pass the value histogram of all voxels, or of the selected gradient band, to the transfer function editor
+	void update_histogram_display();
+	/// stream the voxels of the mapped file in chunks and call f(const uint8_t* bytes, size_t first_voxel, size_t count) with data in host byte order
+	template <typename F>
+	void decode_mapped_voxels(size_t num_voxels, size_t voxel_size, bool swap_bytes, F&& f);
+	/// convert count voxels of the given type to floats, either with the SIMD kernels or the scalar loop
+	static void widen_voxels(cgv::type::info::TypeId type, const uint8_t* src, float* dst, size_t count, float scale, bool use_simd);
+	/// time the parallel SIMD byte to float conversion against the scalar loop and print the results
+	void benchmark_conversion();
+	/// pointer to the first voxel of the current volume, either inside the mapped file, vol_native_data or vol_data
+	const void* get_voxel_data() const;
+	/// size in bytes, normalization scale and display name of the supported voxel types
+	static size_t get_voxel_type_size(cgv::type::info::TypeId type);
+	static float get_voxel_type_scale(cgv::type::info::TypeId type);
+	static std::string get_voxel_type_name(cgv::type::info::TypeId type);
+	/// set vol_value_scale and vol_value_offset for the current volume, float volumes with values outside [0,1] are mapped from their value range
+	void update_value_normalization();
+	/// call f(const T* voxels, size_t num_voxels, float scale, float offset) with the voxels in their stored type T, where value * scale + offset normalizes them to [0,1]
+	template <typename F>
+	void visit_voxels(F&& f) const;
+	/// stream the bricks [first_brick, last_brick) of an out-of-core volume through the cache and call
+	/// f(size_t brick, const T* voxels, const unsigned begin[3], const unsigned end[3], float scale, float offset) with the densely packed voxels of each brick
+	template <typename F>
+	void visit_cached_bricks(size_t first_brick, size_t last_brick, F&& f);
+	/// build the downsampled proxy of an out-of-core volume that fits into budget_bytes, together with the brick value ranges
+	void build_proxy_volume(size_t budget_bytes);
+
 	void fit_to_resolution();
 	void fit_to_spacing();
 	void fit_to_resolution_and_spacing();
 
 	vec3 sample_sphere();
 
-	void create_histogram();
+	/// rebuild the brick value ranges and statistics of the current volume in a single pass, classify the bricks with the transfer function
+	/// and show the histogram in the transfer function editor
+	void update_volume_statistics();
+	/// mark bricks as invisible whose value range is mapped to zero opacity by the transfer function
+	void classify_bricks();
+
 	void center_and_zoom(float zoom) const;
 
 	// Have a function allowing to resize our render target
 	void resize_render_target() const;
 	void generate_samples();
+	/// load, configure and generate the samples of the batch, then exit with 0 on success, 1 if samples are missing and 2 if loading failed
+	void run_batch(double, double);
 	void export_transfer_function();
 	void export_volume_data();
 
 	void save_buffer_to_file(cgv::render::context& ctx);
 	const std::string dump_image_to_path(const std::string& file_path);
+	/// file name of the generated sample with the given index
+	static std::string get_sample_file_name(size_t index);
+	/// encode an RGBA8 image as read back from OpenGL, bottom row first, with the encoder and write it as png, returns whether the file was written;
+	/// large images are split into strips that are compressed by up to num_threads threads, flags are passed on to fpng
+	static bool write_png(const std::string& filename, const uint8_t* data, unsigned width, unsigned height, fpng::fpng_encoder& encoder, unsigned num_threads = 1, uint32_t flags = 0);
+	/// fpng flags used for generated samples and screenshots
+	uint32_t get_png_flags() const;
+	/// time the png checksums and encoding of the current frame with each SIMD level fpng supports on this CPU, and the reused encoder
+	/// against the stateless encoding at several sizes, and the adaptive filters and trained tables against Up only and the photo tables, and print the throughput
+	void benchmark_png_encoding();
 
 public:
 	// default constructor
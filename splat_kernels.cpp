@@ -0,0 +1,46 @@
+#include "splat_kernels.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SPLAT_KERNELS_SSE2 1
+#include <emmintrin.h>
+#else
+#define SPLAT_KERNELS_SSE2 0
+#endif
+
+void splat_sphere_row(float* row, int x_begin, int x_end, float x_origin, float voxel_size, float center_x, float dy_sq, float dz_sq, float radius, float contribution) {
+
+	int x = x_begin;
+
+#if SPLAT_KERNELS_SSE2
+	// 4 voxels per iteration, every operation is a correctly rounded single precision operation like its scalar counterpart
+	const __m128 origin = _mm_set1_ps(x_origin);
+	const __m128 size = _mm_set1_ps(voxel_size);
+	const __m128 center = _mm_set1_ps(center_x);
+	const __m128 dy2 = _mm_set1_ps(dy_sq);
+	const __m128 dz2 = _mm_set1_ps(dz_sq);
+	const __m128 r = _mm_set1_ps(radius);
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 c = _mm_set1_ps(contribution);
+
+	for(; x + 4 <= x_end; x += 4) {
+		const __m128 pos = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_setr_epi32(x, x + 1, x + 2, x + 3)), size), origin);
+		const __m128 dx = _mm_sub_ps(pos, center);
+		const __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), dy2), dz2));
+		const __m128 inside = _mm_cmplt_ps(dist, r);
+
+		// voxels outside the sphere keep their exact value, including its sign
+		const __m128 v = _mm_loadu_ps(row + (x - x_begin));
+		const __m128 sum = _mm_add_ps(v, _mm_mul_ps(c, _mm_sqrt_ps(_mm_sub_ps(one, _mm_div_ps(dist, r)))));
+		_mm_storeu_ps(row + (x - x_begin), _mm_or_ps(_mm_and_ps(inside, sum), _mm_andnot_ps(inside, v)));
+	}
+#endif
+
+	for(; x < x_end; ++x) {
+		const float dx = (static_cast<float>(x) * voxel_size + x_origin) - center_x;
+		const float dist = std::sqrt((dx * dx + dy_sq) + dz_sq);
+		if(dist < radius)
+			row[x - x_begin] += contribution * std::sqrt(1.0f - (dist / radius));
+	}
+}
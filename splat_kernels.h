@@ -0,0 +1,8 @@
+#pragma once
+
+// Kernels used to build the generated default volume.
+
+/// add contribution * sqrt(1 - dist / radius) to each voxel in [x_begin, x_end) of a volume row whose center lies strictly inside the sphere;
+/// row points to voxel x_begin, the center of voxel x lies at x * voxel_size + x_origin and dist = sqrt(((center_x - x)^2 + dy_sq) + dz_sq)
+/// is evaluated in exactly the order of the per voxel vector code, so that results are bit-identical to it
+void splat_sphere_row(float* row, int x_begin, int x_end, float x_origin, float voxel_size, float center_x, float dy_sq, float dz_sq, float radius, float contribution);
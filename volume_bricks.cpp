@@ -0,0 +1,115 @@
+#include "volume_bricks.h"
+
+#include <cmath>
+
+void volume_bricks::clear() {
+
+	for(int i = 0; i < 3; ++i) {
+		volume_res[i] = 0;
+		brick_res[i] = 0;
+	}
+
+	min_values.clear();
+	max_values.clear();
+	visible.clear();
+}
+
+void volume_bricks::reset(unsigned res_x, unsigned res_y, unsigned res_z) {
+
+	volume_res[0] = res_x;
+	volume_res[1] = res_y;
+	volume_res[2] = res_z;
+
+	for(int i = 0; i < 3; ++i)
+		brick_res[i] = (volume_res[i] + brick_size - 1) / brick_size;
+
+	const size_t num_bricks = static_cast<size_t>(brick_res[0]) * brick_res[1] * brick_res[2];
+	min_values.assign(num_bricks, 0.0f);
+	max_values.assign(num_bricks, 0.0f);
+	visible.clear();
+}
+
+void volume_bricks::dilate() {
+
+	const std::vector<float> tight_min = min_values;
+	const std::vector<float> tight_max = max_values;
+
+	for(unsigned z = 0; z < brick_res[2]; ++z) {
+		for(unsigned y = 0; y < brick_res[1]; ++y) {
+			for(unsigned x = 0; x < brick_res[0]; ++x) {
+				const size_t brick = x + brick_res[0] * (y + static_cast<size_t>(brick_res[1]) * z);
+
+				for(unsigned nz = z > 0 ? z - 1 : 0; nz <= std::min(z + 1, brick_res[2] - 1); ++nz) {
+					for(unsigned ny = y > 0 ? y - 1 : 0; ny <= std::min(y + 1, brick_res[1] - 1); ++ny) {
+						for(unsigned nx = x > 0 ? x - 1 : 0; nx <= std::min(x + 1, brick_res[0] - 1); ++nx) {
+							const size_t neighbor = nx + brick_res[0] * (ny + static_cast<size_t>(brick_res[1]) * nz);
+							min_values[brick] = std::min(min_values[brick], tight_min[neighbor]);
+							max_values[brick] = std::max(max_values[brick], tight_max[neighbor]);
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void volume_bricks::get_voxel_range(size_t brick, unsigned begin[3], unsigned end[3]) const {
+
+	const size_t brick_idx[3] = {
+		brick % brick_res[0],
+		(brick / brick_res[0]) % brick_res[1],
+		brick / (static_cast<size_t>(brick_res[0]) * brick_res[1])
+	};
+
+	for(int i = 0; i < 3; ++i) {
+		begin[i] = static_cast<unsigned>(brick_idx[i] * brick_size);
+		end[i] = std::min(begin[i] + brick_size, volume_res[i]);
+	}
+}
+
+size_t volume_bricks::get_num_voxels(size_t brick) const {
+
+	unsigned begin[3], end[3];
+	get_voxel_range(brick, begin, end);
+	return static_cast<size_t>(end[0] - begin[0]) * (end[1] - begin[1]) * (end[2] - begin[2]);
+}
+
+size_t volume_bricks::get_first_voxel(size_t brick) const {
+
+	unsigned begin[3], end[3];
+	get_voxel_range(brick, begin, end);
+	return begin[0] + static_cast<size_t>(volume_res[0]) * (begin[1] + static_cast<size_t>(volume_res[1]) * begin[2]);
+}
+
+void volume_bricks::classify(const std::vector<float>& opacity_table) {
+
+	if(opacity_table.empty()) {
+		visible.clear();
+		return;
+	}
+
+	// prefix counts of table entries with non-zero opacity answer each brick's range query in constant time
+	const size_t n = opacity_table.size();
+	std::vector<size_t> opaque_prefix(n + 1, 0);
+	for(size_t i = 0; i < n; ++i)
+		opaque_prefix[i + 1] = opaque_prefix[i] + (opacity_table[i] > 0.0f ? 1 : 0);
+
+	const auto table_index = [n](float value, bool round_up) {
+		const float position = std::min(std::max(value, 0.0f), 1.0f) * static_cast<float>(n - 1);
+		return static_cast<size_t>(round_up ? std::ceil(position) : std::floor(position));
+	};
+
+	visible.resize(min_values.size());
+	for(size_t brick = 0; brick < min_values.size(); ++brick) {
+		const size_t first = table_index(min_values[brick], false);
+		const size_t last = table_index(max_values[brick], true);
+		visible[brick] = opaque_prefix[last + 1] > opaque_prefix[first] ? 1 : 0;
+	}
+}
+
+size_t volume_bricks::get_num_visible() const {
+
+	if(visible.empty())
+		return min_values.size();
+	return static_cast<size_t>(std::count(visible.begin(), visible.end(), uint8_t(1)));
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "parallel_for.h"
+
+/// subdivision of a volume stored as flat x-fastest array into cubic bricks, recording the normalized value range of each brick
+/// so that passes over the volume can skip bricks which are uniform or invisible under the current transfer function
+class volume_bricks
+{
+public:
+	/// edge length of a brick in voxels
+	static const unsigned brick_size = 32;
+
+	/// compute the value range of every brick, normalized as value * scale + offset, including a one voxel apron so that interpolated samples
+	/// at brick borders are covered; while a brick is in cache, visit_row(thread_index, row, count, x, y, z) is called for each of its x-rows without apron
+	template <typename T, typename F>
+	void build(const T* voxels, unsigned res_x, unsigned res_y, unsigned res_z, float scale, float offset, F&& visit_row);
+	void clear();
+
+	/// prepare the layout for the given volume resolution with empty ranges, to be filled by set_range when the voxels are streamed
+	void reset(unsigned res_x, unsigned res_y, unsigned res_z);
+	/// set the value range of a brick without apron
+	void set_range(size_t brick, float min_value, float max_value) { min_values[brick] = min_value; max_values[brick] = max_value; }
+	/// widen every range by the ranges of its 26 neighbors, a conservative replacement for the apron when ranges were set per brick
+	void dilate();
+
+	bool empty() const { return min_values.empty(); }
+	size_t get_num_bricks() const { return min_values.size(); }
+	const unsigned* get_brick_resolution() const { return brick_res; }
+
+	float get_min(size_t brick) const { return min_values[brick]; }
+	float get_max(size_t brick) const { return max_values[brick]; }
+	/// whether all voxels of the brick and its apron share the same value
+	bool is_uniform(size_t brick) const { return min_values[brick] == max_values[brick]; }
+
+	/// first voxel index (inclusive) and last voxel index (exclusive) of the brick along each axis
+	void get_voxel_range(size_t brick, unsigned begin[3], unsigned end[3]) const;
+	/// number of voxels inside the brick, without apron
+	size_t get_num_voxels(size_t brick) const;
+	/// flat index of the brick's voxel with the smallest coordinates
+	size_t get_first_voxel(size_t brick) const;
+
+	/// call f(first_voxel_index, count) for each x-row of the brick
+	template <typename F>
+	void for_each_row(size_t brick, F&& f) const;
+
+	/// mark bricks as invisible if the given opacity table, sampled uniformly over [0,1], is zero for their whole value range
+	void classify(const std::vector<float>& opacity_table);
+	/// whether the last classification left the brick visible; all bricks are visible before the first classification
+	bool is_visible(size_t brick) const { return visible.empty() || visible[brick] != 0; }
+	size_t get_num_visible() const;
+
+private:
+	unsigned volume_res[3] = { 0, 0, 0 };
+	unsigned brick_res[3] = { 0, 0, 0 };
+	std::vector<float> min_values;
+	std::vector<float> max_values;
+	std::vector<uint8_t> visible;
+};
+
+template <typename T, typename F>
+void volume_bricks::build(const T* voxels, unsigned res_x, unsigned res_y, unsigned res_z, float scale, float offset, F&& visit_row) {
+
+	reset(res_x, res_y, res_z);
+
+	const size_t num_bricks = get_num_bricks();
+	if(num_bricks == 0)
+		return;
+
+	const size_t slice_size = static_cast<size_t>(res_x) * res_y;
+
+	// every thread handles whole bricks, so the result does not depend on the number of threads
+	parallel_for_each(num_bricks, [&](unsigned thread_index, size_t brick) {
+		unsigned inner_begin[3], inner_end[3];
+		get_voxel_range(brick, inner_begin, inner_end);
+
+		// extend the range by the apron
+		unsigned begin[3], end[3];
+		for(int i = 0; i < 3; ++i) {
+			begin[i] = inner_begin[i] > 0 ? inner_begin[i] - 1 : 0;
+			end[i] = std::min(inner_end[i] + 1, volume_res[i]);
+		}
+
+		T min_value = voxels[begin[0] + static_cast<size_t>(res_x) * begin[1] + slice_size * begin[2]];
+		T max_value = min_value;
+
+		for(unsigned z = begin[2]; z < end[2]; ++z) {
+			for(unsigned y = begin[1]; y < end[1]; ++y) {
+				const T* row = voxels + slice_size * z + static_cast<size_t>(res_x) * y;
+				for(unsigned x = begin[0]; x < end[0]; ++x) {
+					min_value = std::min(min_value, row[x]);
+					max_value = std::max(max_value, row[x]);
+				}
+
+				if(y >= inner_begin[1] && y < inner_end[1] && z >= inner_begin[2] && z < inner_end[2])
+					visit_row(thread_index, row + inner_begin[0], inner_end[0] - inner_begin[0], inner_begin[0], y, z);
+			}
+		}
+
+		min_values[brick] = static_cast<float>(min_value) * scale + offset;
+		max_values[brick] = static_cast<float>(max_value) * scale + offset;
+	});
+}
+
+template <typename F>
+void volume_bricks::for_each_row(size_t brick, F&& f) const {
+
+	unsigned begin[3], end[3];
+	get_voxel_range(brick, begin, end);
+
+	const size_t slice_size = static_cast<size_t>(volume_res[0]) * volume_res[1];
+
+	for(unsigned z = begin[2]; z < end[2]; ++z)
+		for(unsigned y = begin[1]; y < end[1]; ++y)
+			f(slice_size * z + static_cast<size_t>(volume_res[0]) * y + begin[0], static_cast<size_t>(end[0] - begin[0]));
+}
@@ -0,0 +1,15 @@
+#include "volume_statistics.h"
+
+void volume_statistics::clear() {
+
+	std::fill(histogram.begin(), histogram.end(), 0u);
+	min_value = 0.0f;
+	max_value = 0.0f;
+	mean_value = 0.0f;
+	num_voxels = 0;
+
+	for(int i = 0; i < 3; ++i) {
+		nonempty_begin[i] = 0;
+		nonempty_end[i] = 0;
+	}
+}
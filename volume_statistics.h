@@ -0,0 +1,167 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+/// statistics of the normalized voxel values of a volume: a histogram over [0,1], the value range and mean,
+/// and the bounding box of all voxels whose normalized value is above zero
+class volume_statistics
+{
+public:
+	static const unsigned num_buckets = 128;
+
+	/// statistics of the voxels seen by one thread, kept in the stored voxel type T; integer voxels are counted per value
+	/// and only mapped to histogram buckets when merged, float voxels are normalized with scale and offset and counted per bucket directly
+	template <typename T>
+	struct accumulator {
+		std::vector<size_t> counts;
+		float scale = 1.0f;
+		float offset = 0.0f;
+		T min_value = std::numeric_limits<T>::max();
+		T max_value = std::numeric_limits<T>::lowest();
+		double sum = 0.0;
+		size_t num_voxels = 0;
+		unsigned nonempty_begin[3] = { std::numeric_limits<unsigned>::max(), std::numeric_limits<unsigned>::max(), std::numeric_limits<unsigned>::max() };
+		unsigned nonempty_end[3] = { 0, 0, 0 };
+
+		accumulator(float scale = 1.0f, float offset = 0.0f) : counts(std::is_integral_v<T> ? size_t(std::numeric_limits<T>::max()) + 1 : num_buckets, 0u), scale(scale), offset(offset) {}
+
+		/// add count voxels of the x-row starting at voxel (x, y, z)
+		void add_row(const T* row, unsigned count, unsigned x, unsigned y, unsigned z);
+	};
+
+	void clear();
+	/// combine the accumulators of all threads, where value * scale + offset normalizes the voxel values to [0,1]
+	template <typename T>
+	void merge(const std::vector<accumulator<T>>& accumulators, float scale, float offset);
+
+	bool empty() const { return num_voxels == 0; }
+	const std::vector<unsigned>& get_histogram() const { return histogram; }
+	float get_min() const { return min_value; }
+	float get_max() const { return max_value; }
+	float get_mean() const { return mean_value; }
+	/// whether any voxel has a normalized value above zero
+	bool has_nonempty_box() const { return nonempty_begin[0] < nonempty_end[0]; }
+	/// first voxel index (inclusive) and last voxel index (exclusive) of the non-empty voxels along each axis
+	const unsigned* get_nonempty_begin() const { return nonempty_begin; }
+	const unsigned* get_nonempty_end() const { return nonempty_end; }
+
+	/// histogram bucket of a normalized value
+	static size_t bucket_of(float value) { return std::min(static_cast<size_t>(std::max(value, 0.0f) * static_cast<float>(num_buckets)), size_t(num_buckets - 1)); }
+
+private:
+	std::vector<unsigned> histogram = std::vector<unsigned>(num_buckets, 0u);
+	float min_value = 0.0f;
+	float max_value = 0.0f;
+	float mean_value = 0.0f;
+	size_t num_voxels = 0;
+	unsigned nonempty_begin[3] = { 0, 0, 0 };
+	unsigned nonempty_end[3] = { 0, 0, 0 };
+};
+
+template <typename T>
+void volume_statistics::accumulator<T>::add_row(const T* row, unsigned count, unsigned x, unsigned y, unsigned z) {
+
+	T row_min = min_value;
+	T row_max = max_value;
+	double row_sum = 0.0;
+	unsigned first_nonzero = count;
+	unsigned last_nonzero = 0;
+
+	for(unsigned i = 0; i < count; ++i) {
+		const T value = row[i];
+
+		if constexpr(std::is_integral_v<T>)
+			++counts[value];
+		else
+			++counts[bucket_of(static_cast<float>(value) * scale + offset)];
+
+		row_min = std::min(row_min, value);
+		row_max = std::max(row_max, value);
+		row_sum += static_cast<double>(value);
+
+		// float voxels are empty at their normalized zero, which is not the stored zero if they were mapped from their value range
+		bool nonempty;
+		if constexpr(std::is_integral_v<T>)
+			nonempty = value != T(0);
+		else
+			nonempty = static_cast<float>(value) * scale + offset > 0.0f;
+
+		if(nonempty) {
+			first_nonzero = std::min(first_nonzero, i);
+			last_nonzero = i;
+		}
+	}
+
+	min_value = row_min;
+	max_value = row_max;
+	sum += row_sum;
+	num_voxels += count;
+
+	if(first_nonzero < count) {
+		nonempty_begin[0] = std::min(nonempty_begin[0], x + first_nonzero);
+		nonempty_begin[1] = std::min(nonempty_begin[1], y);
+		nonempty_begin[2] = std::min(nonempty_begin[2], z);
+		nonempty_end[0] = std::max(nonempty_end[0], x + last_nonzero + 1);
+		nonempty_end[1] = std::max(nonempty_end[1], y + 1);
+		nonempty_end[2] = std::max(nonempty_end[2], z + 1);
+	}
+}
+
+template <typename T>
+void volume_statistics::merge(const std::vector<accumulator<T>>& accumulators, float scale, float offset) {
+
+	clear();
+
+	std::vector<size_t> counts;
+	T merged_min = std::numeric_limits<T>::max();
+	T merged_max = std::numeric_limits<T>::lowest();
+	double sum = 0.0;
+
+	for(int i = 0; i < 3; ++i)
+		nonempty_begin[i] = std::numeric_limits<unsigned>::max();
+
+	for(const auto& acc : accumulators) {
+		if(acc.num_voxels == 0)
+			continue;
+
+		if(counts.empty())
+			counts.assign(acc.counts.size(), 0u);
+		for(size_t v = 0; v < counts.size(); ++v)
+			counts[v] += acc.counts[v];
+
+		merged_min = std::min(merged_min, acc.min_value);
+		merged_max = std::max(merged_max, acc.max_value);
+		sum += acc.sum;
+		num_voxels += acc.num_voxels;
+
+		for(int i = 0; i < 3; ++i) {
+			nonempty_begin[i] = std::min(nonempty_begin[i], acc.nonempty_begin[i]);
+			nonempty_end[i] = std::max(nonempty_end[i], acc.nonempty_end[i]);
+		}
+	}
+
+	if(num_voxels == 0 || nonempty_begin[0] >= nonempty_end[0]) {
+		for(int i = 0; i < 3; ++i) {
+			nonempty_begin[i] = 0;
+			nonempty_end[i] = 0;
+		}
+	}
+
+	if(num_voxels == 0)
+		return;
+
+	// only the distinct integer values are mapped to buckets
+	for(size_t v = 0; v < counts.size(); ++v) {
+		const size_t bucket = std::is_integral_v<T> ? bucket_of(static_cast<float>(v) * scale + offset) : v;
+		histogram[bucket] += static_cast<unsigned>(counts[v]);
+	}
+
+	min_value = static_cast<float>(merged_min) * scale + offset;
+	max_value = static_cast<float>(merged_max) * scale + offset;
+	mean_value = static_cast<float>(sum / static_cast<double>(num_voxels)) * scale + offset;
+}
@@ -0,0 +1,95 @@
+#include "voxel_conversion.h"
+
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VOXEL_CONVERSION_SSE2 1
+#include <emmintrin.h>
+#else
+#define VOXEL_CONVERSION_SSE2 0
+#endif
+
+void swap_bytes_16(const uint8_t* src, uint8_t* dst, size_t count) {
+
+	size_t i = 0;
+
+#if VOXEL_CONVERSION_SSE2
+	// 8 values per iteration, swapping bytes by shifting each 16 bit lane in both directions
+	for(; i + 8 <= count; i += 8) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 2 * i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+	}
+#endif
+
+	for(; i < count; ++i) {
+		dst[2 * i + 0] = src[2 * i + 1];
+		dst[2 * i + 1] = src[2 * i + 0];
+	}
+}
+
+void swap_bytes_32(const uint8_t* src, uint8_t* dst, size_t count) {
+
+	size_t i = 0;
+
+#if VOXEL_CONVERSION_SSE2
+	// 4 values per iteration, first exchanging the 16 bit halves and then the bytes inside each half
+	for(; i + 4 <= count; i += 4) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 4 * i));
+		v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+	}
+#endif
+
+	for(; i < count; ++i) {
+		dst[4 * i + 0] = src[4 * i + 3];
+		dst[4 * i + 1] = src[4 * i + 2];
+		dst[4 * i + 2] = src[4 * i + 1];
+		dst[4 * i + 3] = src[4 * i + 0];
+	}
+}
+
+void widen_uint8_to_float(const uint8_t* src, float* dst, size_t count, float scale) {
+
+	size_t i = 0;
+
+#if VOXEL_CONVERSION_SSE2
+	// 16 values per iteration, zero extending bytes to 16 and then 32 bit integers before converting
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 s = _mm_set1_ps(scale);
+
+	for(; i + 16 <= count; i += 16) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+		const __m128i lo = _mm_unpacklo_epi8(v, zero);
+		const __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+		_mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), s));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), s));
+		_mm_storeu_ps(dst + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), s));
+		_mm_storeu_ps(dst + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), s));
+	}
+#endif
+
+	for(; i < count; ++i)
+		dst[i] = static_cast<float>(src[i]) * scale;
+}
+
+void widen_uint16_to_float(const uint16_t* src, float* dst, size_t count, float scale) {
+
+	size_t i = 0;
+
+#if VOXEL_CONVERSION_SSE2
+	// 8 values per iteration, zero extending to 32 bit integers before converting
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 s = _mm_set1_ps(scale);
+
+	for(; i + 8 <= count; i += 8) {
+		const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+
+		_mm_storeu_ps(dst + i + 0, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), s));
+		_mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), s));
+	}
+#endif
+
+	for(; i < count; ++i)
+		dst[i] = static_cast<float>(src[i]) * scale;
+}
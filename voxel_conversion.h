@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Conversion kernels used while loading raw voxel files. Sources may be unaligned and are read bytewise where needed.
+
+/// copy count 16 bit values from src to dst while reversing the byte order of each value
+void swap_bytes_16(const uint8_t* src, uint8_t* dst, size_t count);
+/// copy count 32 bit values from src to dst while reversing the byte order of each value
+void swap_bytes_32(const uint8_t* src, uint8_t* dst, size_t count);
+
+/// convert count unsigned bytes to floats, multiplying each value by scale
+void widen_uint8_to_float(const uint8_t* src, float* dst, size_t count, float scale);
+/// convert count unsigned 16 bit values to floats, multiplying each value by scale
+void widen_uint16_to_float(const uint16_t* src, float* dst, size_t count, float scale);